@@ -0,0 +1,127 @@
+/*
+	wrx-engine: data table churn benchmark
+
+	a table kept near its load factor while names come and go at random,
+	the way enemies or bullets keyed by id would. after filling it, each epoch
+	is 2M puts and deletes, then every name is looked up and the groups of 16
+	slots each probe walked are counted. with deletes shifting pairs back the
+	capacity and the probe lengths should hold still from epoch to epoch.
+	it pulls in data.cpp itself to see the slots, build with "make bench" and
+	run bench_churn from the obj directory
+
+	MIT License
+*/
+
+#include "../src/data.cpp"
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCH_NAMES     262144
+#define BENCH_LIVE      225000          // just under the load factor of the first size that fits
+#define BENCH_OPS       2000000
+#define BENCH_EPOCHS    20
+
+int wrxError(wrxState *p, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(p->error, WRX_LINE, fmt, args);
+    va_end(args);
+    printf("%s\n", p->error);
+    return WRX_ERR;
+}
+
+// the table holds the name only, the value is just a marker
+static void* bench_val_cp(const void *data, void *arg) {
+    return (void*)data;
+}
+
+static void bench_val_free(void *data, void *arg) {
+}
+
+static oa_val_ops bench_val_ops = { bench_val_cp, bench_val_free, NULL };
+
+static double benchNow() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the groups a probe for key walks in slots, to the one holding it or to the
+// first with an empty slot
+static size_t benchGroups(oa_slots *slots, uint32_t hash, const void *key) {
+    size_t mask = slots->capacity - 1;
+    size_t idx = OA_CTRL_H1(hash) & mask;
+    size_t groups = 1;
+
+    for (;;) {
+        for (int i = 0; i < OA_GROUP; i++) {
+            size_t at = (idx + i) & mask;
+            if (!(slots->ctrl[at] & 0x80) && slots->pairs[at].key == key) return groups;
+        }
+        if (oa_group_match(slots->ctrl + idx, OA_CTRL_EMPTY) != 0) return groups;
+        idx = (idx + OA_GROUP) & mask;
+        groups++;
+    }
+}
+
+int main(int argc, char **argv) {
+    static const char *name[BENCH_NAMES];
+    static char live[BENCH_NAMES];
+    unsigned int r = 1;
+    int marker = 0, count = 0, bad = 0;
+    char buf[32];
+    oa_hash *t;
+
+    dwrxStart();
+    t = oa_hash_new(oa_key_ops_name, bench_val_ops);
+    for (int i = 0; i < BENCH_NAMES; i++) {
+        snprintf(buf, sizeof(buf), "enemy.%d", i);
+        name[i] = dwrxIntern(buf);
+    }
+
+    printf("%d names, %d live, %d ops an epoch\n", BENCH_NAMES, BENCH_LIVE, BENCH_OPS);
+    for (int e = 0; e <= BENCH_EPOCHS; e++) {
+        double start = benchNow(), took;
+        double hit = 0, miss = 0;
+        size_t worst = 0, tombstones = 0, g;
+
+        // epoch 0 only fills it
+        for (int op = 0; op < (e ? BENCH_OPS : 0) || count < BENCH_LIVE; op++) {
+            r = r * 1103515245 + 12345;
+            int i = (r >> 8) % BENCH_NAMES;
+            if (count < BENCH_LIVE && !live[i]) {
+                oa_hash_put(t, name[i], &marker);
+                live[i] = 1;
+                count++;
+            } else if (count >= BENCH_LIVE && live[i]) {
+                oa_hash_delete(t, name[i]);
+                live[i] = 0;
+                count--;
+            }
+        }
+        took = benchNow() - start;
+
+        for (size_t i = 0; i < t->cur.capacity; i++) {
+            if (t->cur.ctrl[i] == OA_CTRL_DELETED) tombstones++;
+        }
+        for (int i = 0; i < BENCH_NAMES; i++) {
+            g = benchGroups(&t->cur, dwrxNameHash(name[i]), name[i]);
+            if (live[i]) {
+                hit += g;
+                if (g > worst) worst = g;
+            } else miss += g;
+            if ((oa_hash_get(t, name[i]) != NULL) != live[i]) bad = 1;
+        }
+        printf("epoch %2d capacity %zu tombstones %zu hit %.2f groups (worst %zu) miss %.2f groups %.0fns/op\n",
+            e, t->cur.capacity, tombstones, hit / count, worst, miss / (BENCH_NAMES - count),
+            e ? took / BENCH_OPS * 1e9 : 0.0);
+    }
+    if (bad) printf("a get disagreed with what was put\n");
+
+    oa_hash_free(t);
+    for (int i = 0; i < BENCH_NAMES; i++) dwrxNameRelease(name[i]);
+    dwrxStop();
+    return bad;
+}
@@ -0,0 +1,162 @@
+/*
+	wrx-engine: gTable benchmark
+
+	readers and a few writers hammer one table of names, first through
+	dwrxSharedGet()/dwrxSharedPut() and then through a data table behind one
+	mutex, at 1, 4, 8 and 16 threads. the main thread publishes a frame every
+	16ms like wrxUpdate() would, so the epoch moves and retired infos go.
+	build with "make bench", run bench_shared from the obj directory
+
+	MIT License
+*/
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include "../src/wrx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCH_NAMES		100000
+#define BENCH_WRITES	13			// out of 256, about 5%
+#define BENCH_SECONDS	1.0
+#define BENCH_THREADS	16
+
+typedef struct {
+	wrxThread t;
+	unsigned int seed;
+	long long ops;
+} benchWorker;
+
+static wrxState *bp;
+static void *bplain;
+static pthread_mutex_t bplainLock;
+static char bnames[BENCH_NAMES][24];
+static int bstop, bshared, bbad;
+
+int wrxError(wrxState *p, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(p->error, WRX_LINE, fmt, args);
+	va_end(args);
+	printf("%s\n", p->error);
+	return WRX_ERR;
+}
+
+static double benchNow() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// both halves of the value match, a torn read wouldn't
+static void benchCheck(const wrxInfo *v) {
+	if (v == NULL || v->l[0] != v->l[1]) xatomic_store(&bbad, 1);
+}
+
+static xthread_ret benchWork(void *arg) {
+	benchWorker *w = arg;
+	unsigned int r = w->seed;
+	wrxInfo v;
+	int i, k;
+
+	memset(&v, 0, sizeof(wrxInfo));
+	v.form = WRX_FORM_INTEGER;
+	while (!xatomic_load(&bstop)) {
+		// a job's worth, then let go of the pin like a worker does
+		for (k = 0; k < 1000; k++) {
+			r = r * 1103515245 + 12345;
+			i = (r >> 8) % BENCH_NAMES;
+			if ((r & 0xff) < BENCH_WRITES) {
+				v.l[0] = v.l[1] = r;
+				if (bshared) {
+					dwrxSharedPut(bp->gTable, bnames[i], &v);
+				} else {
+					pthread_mutex_lock(&bplainLock);
+					dwrxTablePut(bplain, bnames[i], &v);
+					pthread_mutex_unlock(&bplainLock);
+				}
+			} else if (bshared) {
+				benchCheck(dwrxSharedGet(bp->gTable, &w->t, bnames[i]));
+			} else {
+				pthread_mutex_lock(&bplainLock);
+				benchCheck(dwrxTableGet(bplain, bnames[i]));
+				pthread_mutex_unlock(&bplainLock);
+			}
+		}
+		w->ops += k;
+		if (bshared) wrxSnapshotRelease(bp, &w->t);
+	}
+	return 0;
+}
+
+static void benchRun(int threads) {
+	benchWorker w[BENCH_THREADS];
+	pthread_t handle[BENCH_THREADS];
+	double start, took;
+	long long ops = 0;
+	int i;
+
+	memset(w, 0, sizeof(w));
+	xatomic_store(&bstop, 0);
+	for (i = 0; i < threads; i++) {
+		w[i].t.id = i;
+		w[i].seed = i * 7919 + 1;
+		xthread_create(&handle[i], benchWork, &w[i]);
+	}
+	start = benchNow();
+	while (benchNow() - start < BENCH_SECONDS) {
+		if (bshared) wrxPublishShares(bp);
+		usleep(16000);
+	}
+	xatomic_store(&bstop, 1);
+	for (i = 0; i < threads; i++) {
+		xthread_join(handle[i], NULL);
+		ops += w[i].ops;
+	}
+	took = benchNow() - start;
+	printf("%-6s %2d threads %8.2f Mops/s\n", bshared ? "shared" : "mutex", threads, ops / took / 1e6);
+}
+
+int main(int argc, char **argv) {
+	int threads[] = {1, 4, 8, 16};
+	wrxInfo v;
+	int i;
+
+	dwrxStart();
+	bp = calloc(1, sizeof(wrxState));
+	bp->epoch = 1;
+	pthread_mutex_init(&bp->tableLock, NULL);
+	pthread_mutex_init(&bplainLock, NULL);
+	bp->gTable = dwrxNewSharedTable(bp);
+	bplain = dwrxNewTable(bp);
+	if (bp->gTable == NULL || bplain == NULL) return 1;
+
+	memset(&v, 0, sizeof(wrxInfo));
+	v.form = WRX_FORM_INTEGER;
+	for (i = 0; i < BENCH_NAMES; i++) {
+		snprintf(bnames[i], sizeof(bnames[i]), "enemy.%d", i);
+		v.l[0] = v.l[1] = i;
+		dwrxSharedPut(bp->gTable, bnames[i], &v);
+		dwrxTablePut(bplain, bnames[i], &v);
+	}
+	printf("%d names, %d of 256 ops write\n", BENCH_NAMES, BENCH_WRITES);
+	for (bshared = 1; bshared >= 0; bshared--) {
+		for (i = 0; i < 4; i++) benchRun(threads[i]);
+	}
+	if (bbad) printf("a read saw a torn or missing value\n");
+
+	dwrxFreeSharedTable(bp->gTable);
+	dwrxFreeTable(bplain);
+	dwrxStop();
+	pthread_mutex_destroy(&bplainLock);
+	pthread_mutex_destroy(&bp->tableLock);
+	free(bp);
+	return bbad;
+}
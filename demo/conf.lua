@@ -12,6 +12,8 @@ function wrx.conf(cfg)
 	cfg.title = "WRX-ENGINE"
 	cfg.idBits = 16
 	cfg.settings = ""
-	cfg.threads = 4 -- 1-16, 4-8 is reasonable IMO
+	cfg.threads = 0 -- compute workers, 0 is one per core less the main thread
+	cfg.ioThreads = 0 -- workers for blocking loads, 0 picks 1 or 2
+	cfg.pinThreads = false -- pin compute workers to cores
 	cfg.server = false
 end
@@ -0,0 +1,172 @@
+/*
+	wrx-engine: lua allocator
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// every lua state gets its own heap. blocks up to WRX_HEAP_SMALL bytes come
+// from free lists, one per 16 byte size class, carved out of larger chunks.
+// a state only ever runs on one thread at a time so none of this locks, and
+// bigger blocks go to malloc. chunks are only given back when the state closes
+#define WRX_HEAP_GRAIN		16
+#define WRX_HEAP_CLASSES	16
+#define WRX_HEAP_SMALL		(WRX_HEAP_GRAIN * WRX_HEAP_CLASSES)
+#define WRX_HEAP_CHUNK		(64 * 1024)
+
+#define WRX_HEAP_CLASS(n)	(((n) - 1) / WRX_HEAP_GRAIN)
+
+typedef union wrxHeapChunk {
+	union wrxHeapChunk *next;
+	char align[WRX_HEAP_GRAIN];			// keep the blocks after it 16 byte aligned
+} wrxHeapChunk;
+
+typedef struct {
+	void *free[WRX_HEAP_CLASSES];
+	char *bump;							// unused tail of the newest chunk
+	char *end;
+	wrxHeapChunk *chunks;
+	wrxHeapStats stats;
+} wrxLuaHeap;
+
+static void *wrxHeapSmall(wrxLuaHeap *h, size_t size) {
+	int c = WRX_HEAP_CLASS(size);
+	size_t bytes = (c + 1) * WRX_HEAP_GRAIN;
+	wrxHeapChunk *k;
+	void *b = h->free[c];
+
+	if (b != NULL) {
+		h->free[c] = *(void**)b;
+		return b;
+	}
+	if (h->bump == NULL || h->bump + bytes > h->end) {
+		// the rest of the old chunk is too small for this class, so hand it
+		// to the classes that still fit
+		while (h->bump != NULL && h->bump < h->end) {
+			size_t left = h->end - h->bump;
+			int lc = WRX_HEAP_CLASS(left < WRX_HEAP_SMALL ? left : WRX_HEAP_SMALL);
+			*(void**)h->bump = h->free[lc];
+			h->free[lc] = h->bump;
+			h->bump += (lc + 1) * WRX_HEAP_GRAIN;
+		}
+		k = malloc(WRX_HEAP_CHUNK);
+		if (k == NULL) return NULL;
+		k->next = h->chunks;
+		h->chunks = k;
+		h->bump = (char*)(k + 1);
+		h->end = (char*)k + WRX_HEAP_CHUNK;
+		h->stats.pooled += WRX_HEAP_CHUNK;
+	}
+	b = h->bump;
+	h->bump += bytes;
+	return b;
+}
+
+static void wrxHeapRelease(wrxLuaHeap *h, void *b, size_t size) {
+	int c;
+
+	if (size > WRX_HEAP_SMALL) {
+		free(b);
+		return;
+	}
+	c = WRX_HEAP_CLASS(size);
+	*(void**)b = h->free[c];
+	h->free[c] = b;
+}
+
+// the lua_Alloc, osize is the block's size or for a new block the type of
+// object it will hold
+static void *wrxHeapAlloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	wrxLuaHeap *h = ud;
+	void *n;
+
+	if (ptr == NULL) {
+		if (osize < LUA_NUMTYPES) h->stats.objects[osize]++;
+		osize = 0;
+	}
+	if (nsize == 0) {
+		if (ptr != NULL) {
+			wrxHeapRelease(h, ptr, osize);
+			h->stats.bytes -= osize;
+			h->stats.frees++;
+		}
+		return NULL;
+	}
+
+	if (ptr != NULL && osize > WRX_HEAP_SMALL && nsize > WRX_HEAP_SMALL) {
+		// big to big, realloc can often grow in place
+		n = realloc(ptr, nsize);
+	} else if (ptr != NULL && osize <= WRX_HEAP_SMALL && nsize <= WRX_HEAP_SMALL && WRX_HEAP_CLASS(osize) == WRX_HEAP_CLASS(nsize)) {
+		n = ptr;
+	} else {
+		n = (nsize > WRX_HEAP_SMALL) ? malloc(nsize) : wrxHeapSmall(h, nsize);
+		// on failure lua keeps the old block, so it must survive
+		if (n == NULL) return NULL;
+		if (ptr != NULL) {
+			memcpy(n, ptr, (osize < nsize) ? osize : nsize);
+			wrxHeapRelease(h, ptr, osize);
+		}
+	}
+	if (n == NULL) return NULL;
+
+	if (ptr == NULL) h->stats.allocs++;
+	h->stats.bytes += nsize - osize;
+	if (h->stats.bytes > h->stats.peak) h->stats.peak = h->stats.bytes;
+	return n;
+}
+
+static int wrxHeapPanic(lua_State *L) {
+	const char *msg = lua_tostring(L, -1);
+
+	fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", msg ? msg : "error object is not a string");
+	return 0;
+}
+
+// a lua state on its own heap, close it with wrxCloseLuaState()
+lua_State *wrxNewLuaState() {
+	wrxLuaHeap *h = calloc(1, sizeof(wrxLuaHeap));
+	lua_State *L;
+
+	if (h == NULL) return NULL;
+	L = lua_newstate(wrxHeapAlloc, h);
+	if (L == NULL) {
+		wrxFreeLuaHeap(h);
+		return NULL;
+	}
+	lua_atpanic(L, wrxHeapPanic);
+	return L;
+}
+
+void wrxCloseLuaState(lua_State *L) {
+	void *h;
+
+	lua_getallocf(L, &h);
+	lua_close(L);
+	wrxFreeLuaHeap(h);
+}
+
+void wrxFreeLuaHeap(void *heap) {
+	wrxLuaHeap *h = heap;
+	wrxHeapChunk *k;
+
+	if (h == NULL) return;
+	while ((k = h->chunks) != NULL) {
+		h->chunks = k->next;
+		free(k);
+	}
+	free(h);
+}
+
+// a copy of the heap statistics for L, zeroes if it isn't on an engine heap
+void wrxGetHeapStats(lua_State *L, wrxHeapStats *stats) {
+	void *h;
+
+	if (lua_getallocf(L, &h) == wrxHeapAlloc) memcpy(stats, &((wrxLuaHeap*)h)->stats, sizeof(wrxHeapStats));
+		else memset(stats, 0, sizeof(wrxHeapStats));
+}
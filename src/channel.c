@@ -0,0 +1,79 @@
+/*
+	wrx-engine: streaming channels
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <string.h>
+
+// a channel is a ring of bytes between one writer and one reader, each on any
+// thread. head only moves on the writer and tail only on the reader, so
+// neither side ever locks or waits on the other. both count bytes forever and
+// wrap through the mask, so head - tail is always what is waiting
+
+// a channel of at least bytes, rounded up to a power of 2, with one reference
+wrxChannel *wrxNewChannel(unsigned int bytes) {
+	unsigned int capacity = 64;
+	wrxChannel *c;
+
+	if (bytes > (1u << 30)) return NULL;
+	while (capacity < bytes) capacity <<= 1;
+	c = malloc(sizeof(wrxChannel) + capacity);
+	if (c == NULL) return NULL;
+	memset(c, 0, sizeof(wrxChannel));
+	c->refs = 1;
+	c->capacity = capacity;
+	return c;
+}
+
+void wrxRetainChannel(wrxChannel *c) {
+	xatomic_add(&c->refs, 1);
+}
+
+void wrxReleaseChannel(wrxChannel *c) {
+	if (c != NULL && xatomic_sub(&c->refs, 1) == 0) free(c);
+}
+
+// bytes waiting to be read
+unsigned int wrxChannelUsed(wrxChannel *c) {
+	return (unsigned int)(xatomic_load(&c->head) - xatomic_load(&c->tail));
+}
+
+// bytes that can be written right now
+unsigned int wrxChannelRoom(wrxChannel *c) {
+	return c->capacity - wrxChannelUsed(c);
+}
+
+// writer only, copies all of mem in or nothing, WRX_NOPE when there isn't room
+int wrxChannelWrite(wrxChannel *c, const void *mem, unsigned int length) {
+	unsigned long long head = xatomic_load_relaxed(&c->head);
+	unsigned int at = head & (c->capacity - 1), first;
+
+	if (length > c->capacity - (unsigned int)(head - xatomic_load(&c->tail))) return WRX_NOPE;
+	first = c->capacity - at;
+	if (first > length) first = length;
+	memcpy(c->mem + at, mem, first);
+	memcpy(c->mem, (const char*)mem + first, length - first);
+	// the bytes have to land before the reader can see them
+	xatomic_store(&c->head, head + length);
+	return WRX_OK;
+}
+
+// reader only, copies length bytes out or nothing, WRX_NOPE when fewer are waiting
+int wrxChannelRead(wrxChannel *c, void *mem, unsigned int length) {
+	unsigned long long tail = xatomic_load_relaxed(&c->tail);
+	unsigned int at = tail & (c->capacity - 1), first;
+
+	if (length > (unsigned int)(xatomic_load(&c->head) - tail)) return WRX_NOPE;
+	first = c->capacity - at;
+	if (first > length) first = length;
+	memcpy(mem, c->mem + at, first);
+	memcpy((char*)mem + first, c->mem, length - first);
+	// done with the bytes before the writer can reuse them
+	xatomic_store(&c->tail, tail + length);
+	return WRX_OK;
+}
@@ -48,6 +48,25 @@ void wrxSetupLuaState(wrxState *p, lua_State *l) {
 	lwrxRegister(l);
 }
 
+// the stages every frame has, apps add theirs between clear and present
+static void wrxStageInput(wrxState *p, wrxThread *t, void *arg) {
+	wrxPublishShares(p);
+	lwrxDispatchMessages(p);
+	lwrxResumeAwaiting(p);
+}
+
+static void wrxStageTimers(wrxState *p, wrxThread *t, void *arg) {
+	wrxRunTimers(p);
+}
+
+static void wrxStageClear(wrxState *p, wrxThread *t, void *arg) {
+	if (p->screen != NULL && !tigrClosed(p->screen)) tigrClear(p->screen, tigrRGB(0x0, 0x0, 0x0));
+}
+
+static void wrxStagePresent(wrxState *p, wrxThread *t, void *arg) {
+	if (p->screen != NULL && !tigrClosed(p->screen)) tigrUpdate(p->screen);
+}
+
 // just intialize the state with a lua instance, and return it
 wrxState *wrxNewState() {
 	wrxState *ret;
@@ -61,27 +80,38 @@ wrxState *wrxNewState() {
 	ret->fpsTarget = 30.0f;
 	ret->sleepUMS = 5000;
 	ret->idBits = WRX_ID_BITS_16;
-	ret->threads = WRX_MAX_THREADS;
-	ret->L = luaL_newstate();
+	ret->threads = 0;
+	ret->ioThreads = 0;
+	ret->epoch = 1;
+	ret->L = wrxNewLuaState();
 	
 	if (ret->L == NULL) {
 		free(ret);
 		return NULL;
 	}
+	// the main state belongs to no worker thread
+	*(wrxThread**)lua_getextraspace(ret->L) = NULL;
 
 	wrxSetupLuaState(ret, ret->L);
 
 	if (PHYSFS_isInit() == 0) PHYSFS_init(NULL);
 
 	// internal stuff
-	ret->gTable = dwrxNewTable(ret);
-	ret->gTree[0] = calloc(1, sizeof(wrxIdTree));
+	ret->gTable = dwrxNewSharedTable(ret);
+	ret->inbox = wrxNewInbox();
+	ret->gTree[0] = dwrxNewTree(ret, WRX_ID_BITS_16);
 
 	if (ret->gTree[0] == NULL) {
 		free(ret);
 		return NULL;
 	}
-	ret->gTree[0]->idBits = WRX_ID_BITS_16;
+
+	wrxAddStage(ret, "input", wrxStageInput, NULL, WRX_STAGE_MAIN);
+	wrxAddStage(ret, "clear", wrxStageClear, NULL, WRX_STAGE_MAIN);
+	wrxStageAfter(ret, "clear", "input");
+	wrxAddStage(ret, "timers", wrxStageTimers, NULL, WRX_STAGE_MAIN);
+	wrxStageAfter(ret, "timers", "input");
+	wrxAddStage(ret, "present", wrxStagePresent, NULL, WRX_STAGE_MAIN | WRX_STAGE_FINAL);
 
 	// for (int i = 0; i < 256; ret->gTree[i++] = NULL);
 
@@ -155,17 +185,21 @@ int wrxStart(wrxState *p, const char *app) {
 			p->idBits = WRX_ID_BITS_16;
 		}
 		lwrxFieldToFloat(p, -1, "fps", &p->fpsTarget);
+		// pool sizes left at 0 are worked out from the core count by wrxJobStart()
 		lwrxFieldToInteger(p, -1, "threads", &v);
-		if (v > 0) {
-			if (v > WRX_MAX_THREADS) v = WRX_MAX_THREADS;
-			p->threads = v;
-		} else {
-			p->threads = WRX_STD_THREADS;
-		}
+		p->threads = (v > 0) ? v : 0;
+		lwrxFieldToInteger(p, -1, "ioThreads", &v);
+		p->ioThreads = (v > 0) ? v : 0;
+		lwrxFieldToBoolean(p, -1, "pinThreads", &p->pinThreads);
 
 		lua_settop(p->L, top);
 		dwrxFreeInfo(srcFile);
 
+		// create the threads now they are sized, so main.lua's top level can
+		// already hand out jobs and spawn workers
+		ret = wrxJobStart(p);
+		if (ret != WRX_OK) return ret;
+
 		// now main.lua
 		srcFile = dwrxReadFile("main.lua");
 		if (srcFile == NULL)
@@ -183,19 +217,6 @@ int wrxStart(wrxState *p, const char *app) {
 		// ok we have loaded the app, so now let's finish up!
 	}
 
-	// create the threads
-	for (int i = 0; i < p->threads; i++) {
-		wrxThread *pt = calloc(1, sizeof(wrxThread));
-		pt->id = i;
-		pt->mode = WRX_OK;
-		pt->state = p;
-		pt->sleepUMS = 5000;
-		pthread_mutex_init(&pt->stateLock, NULL);
-		pthread_mutex_init(&pt->msgLock, NULL);
-		xthread_create(&pt->handle, wrxThreadRoutine, pt);
-		p->thread[i] = pt;
-	}
-
 	return WRX_OK;
 }
 
@@ -221,11 +242,8 @@ int wrxUpdate(wrxState *p) {
 	p->clock = p->clock + tigrTime();
 	p->dt = p->clock - p->drawClock;
 	p->drawClock = p->clock + (1 / p->fpsTarget);
-	// let's see if we have an open screen
-	if (!tigrClosed(p->screen)) {
-		tigrClear(p->screen, tigrRGB(0x0, 0x0, 0x0));
-		tigrUpdate(p->screen);
-	}
+	// input, the app's stages and present
+	wrxRunFrame(p);
 	// wait and sleep until we need to return
 	while (p->clock < p->drawClock) {
     	usleep(p->sleepUMS);
@@ -236,19 +254,63 @@ int wrxUpdate(wrxState *p) {
 	return WRX_OK;
 }
 
+// a new info with an id under prefix, 0 to 255. gTree[prefix] owns it until
+// wrxFreeIdInfo(), and wrxGetIdInfo() finds it by id. freed ids are used
+// again, each time with a new generation
 wrxInfo* wrxNewIdInfo(wrxState *p, int prefix) {
-	wrxInfo *ret = calloc(1, sizeof(wrxInfo));
+	wrxInfo *ret;
+	wrxIdTree *tree;
 	unsigned int i;
-	// find a new id number for this object
+
+	if (prefix < 0 || prefix > 255) {
+		wrxError(p, "wrxNewIdInfo() prefix %d is out of range", prefix);
+		return NULL;
+	}
+	ret = calloc(1, sizeof(wrxInfo));
+	if (ret == NULL) {
+		wrxError(p, "wrxNewIdInfo() out of memory");
+		return NULL;
+	}
 	pthread_mutex_lock(&p->tableLock);
-	i = p->nextId++;
-	// add the object to the id tree
-	
+	tree = p->gTree[prefix];
+	if (tree == NULL) tree = p->gTree[prefix] = dwrxNewTree(p, p->idBits);
+	// add the object to the id tree, it picks the id
+	i = (tree != NULL) ? dwrxTreeAdd(tree, ret) : 0;
+	pthread_mutex_unlock(&p->tableLock);
+	if (i == 0) {
+		free(ret);
+		wrxError(p, "wrxNewIdInfo() out of ids under prefix %d", prefix);
+		return NULL;
+	}
+	ret->id = WRX_ID(prefix, i);
+	return ret;
+}
+
+// the info with id, or NULL when it was freed
+wrxInfo *wrxGetIdInfo(wrxState *p, unsigned int id) {
+	wrxIdTree *tree;
+	wrxInfo *ret = NULL;
+
+	pthread_mutex_lock(&p->tableLock);
+	tree = p->gTree[WRX_ID_PREFIX(id)];
+	if (tree != NULL) ret = dwrxTreeGet(tree, WRX_ID_NUMBER(id));
 	pthread_mutex_unlock(&p->tableLock);
-	ret->id = i;
 	return ret;
 }
 
+// take v out of its id tree and free it
+void wrxFreeIdInfo(wrxState *p, wrxInfo *v) {
+	wrxIdTree *tree;
+
+	if (v == NULL) return;
+	pthread_mutex_lock(&p->tableLock);
+	tree = p->gTree[WRX_ID_PREFIX(v->id)];
+	// an info that isn't in its tree isn't ours to free
+	if (tree == NULL || dwrxTreeRemove(tree, WRX_ID_NUMBER(v->id)) != v) v = NULL;
+	pthread_mutex_unlock(&p->tableLock);
+	if (v != NULL) dwrxFreeInfo(v);
+}
+
 // *****************************************************************************
 // thread implementation
 int wrxThreadIsOk(wrxThread *p) {
@@ -263,19 +325,21 @@ xthread_ret wrxThreadRoutine(void *p) {
 	wrxThread *pt = p;
 	lua_State *l;
 
-	l = luaL_newstate();
+	l = wrxNewLuaState();
 	if (l == NULL) {
-		return -1;
+		return (xthread_ret)-1;
 	}
 
+	// let the lua state find its way back to this thread
+	*(wrxThread**)lua_getextraspace(l) = pt;
 	wrxSetupLuaState(pt->state, l);
+	pt->L = l;
 
-	printf("Hello from thread %d!\n", pt->id);
+	// run jobs until we are stopped
+	wrxJobWork(pt);
 
-	while (wrxThreadIsOk(pt)) {
-		usleep(pt->sleepUMS);	
-	}
-	
+	pt->L = NULL;
+	wrxCloseLuaState(l);
 	return (xthread_ret)0;
 }
 
@@ -19,10 +19,28 @@
 #include "FreeImage.h"
 
 // *****************************************************************************
-// hash table implementation from: https://github.com/nomemory/open-adressing-hash-table-c
-#define OA_HASH_LOAD_FACTOR 		(0.75)			// 75%
-#define OA_HASH_GROWTH_FACTOR 		(1 << 2)		// x4
-#define OA_HASH_INIT_CAPACITY 		(1 << 8)		// 256
+// hash table, started from: https://github.com/nomemory/open-adressing-hash-table-c
+// and made flat. the pairs sit inline in one array, and a control byte per
+// slot holds 7 bits of the pair's hash, or says the slot is empty. a probe
+// compares 16 control bytes at once and only looks at the pairs whose bits
+// match. probing is linear a group of 16 at a time, and stops at the first
+// group with an empty slot in it.
+// every slot from a pair's home up to the pair is full, so a delete shifts
+// the pairs after it back a slot instead of leaving a tombstone, and probes
+// stay as short as the table's load no matter how much it churns.
+// growing doesn't stop the world: the old slots stay put and each put or
+// delete moves the next few of them over, a get looks in both until the
+// last one has moved
+#define OA_HASH_LOAD_FACTOR 		(0.875)			// 87.5%
+#define OA_HASH_GROWTH_FACTOR 		(1 << 1)		// x2
+#define OA_HASH_INIT_CAPACITY 		(1 << 8)		// 256, always a power of 2
+#define OA_HASH_MIGRATE_STEP		64				// old slots moved per put or delete
+
+#define OA_GROUP					16
+#define OA_CTRL_EMPTY				((uint8_t)0x80)
+#define OA_CTRL_DELETED				((uint8_t)0xFE)	// only in old slots, for what has moved
+#define OA_CTRL_H2(h)				((uint8_t)((h) & 0x7F))
+#define OA_CTRL_H1(h)				((h) >> 7)
 
 typedef struct oa_key_ops_s {
     uint32_t (*hash)(const void *data, void *arg);
@@ -44,26 +62,28 @@ typedef struct oa_pair_s {
     void *val;
 } oa_pair;
 
+typedef struct oa_slots_s {
+    size_t capacity;            // 0 when there is nothing here
+    uint8_t *ctrl;              // capacity + OA_GROUP bytes, the first group is repeated at the end
+    oa_pair *pairs;
+} oa_slots;
+
 typedef struct oa_hash_s {
-    size_t capacity;
     size_t size;
-    oa_pair **buckets;
-    void (*probing_fct)(struct oa_hash_s *htable, size_t *from_idx);
+    oa_slots cur;
+    oa_slots old;               // being moved into cur, a slot at a time
+    size_t migrate;             // next old slot to move
     oa_key_ops key_ops;
     oa_val_ops val_ops;
 } oa_hash;
 
-oa_hash* oa_hash_new(oa_key_ops key_ops, oa_val_ops val_ops, void (*probing_fct)(struct oa_hash_s *htable, size_t *from_idx));
-oa_hash* oa_hash_new_lp(oa_key_ops key_ops, oa_val_ops val_ops);
+oa_hash* oa_hash_new(oa_key_ops key_ops, oa_val_ops val_ops);
 void oa_hash_free(oa_hash *htable);
 void oa_hash_put(oa_hash *htable, const void *key, const void *val);
 void *oa_hash_get(oa_hash *htable, const void *key);
 void oa_hash_delete(oa_hash *htable, const void *key);
 void oa_hash_print(oa_hash *htable, void (*print_key)(const void *k), void (*print_val)(const void *v));
 
-// Pair related
-oa_pair *oa_pair_new(uint32_t hash, const void *key, const void *val, void *arg);
-
 // String operations
 uint32_t oa_string_hash(const void *data, void *arg);
 void* oa_string_cp(const void *data, void *arg);
@@ -71,261 +91,315 @@ bool oa_string_eq(const void *data1, const void *data2, void *arg);
 void oa_string_free(void *data, void *arg);
 void oa_string_print(const void *data);
 
-enum oa_ret_ops { REMOVE, PUT, GET };
-
-static size_t oa_hash_getidx(oa_hash *htable, size_t idx, uint32_t hash_val, const void *key, enum oa_ret_ops op);
-static inline void oa_hash_lp_idx(oa_hash *htable, size_t *idx);
-inline static void oa_hash_grow(oa_hash *htable);
+static void oa_slots_alloc(oa_slots *slots, size_t capacity);
+static void oa_hash_grow(oa_hash *htable);
+static void oa_hash_migrate(oa_hash *htable, size_t count);
 static inline bool oa_hash_should_grow(oa_hash *htable);
-static inline bool oa_hash_is_tombstone(oa_hash *htable, size_t idx);
-static inline void oa_hash_put_tombstone(oa_hash *htable, size_t idx);
-
-oa_hash* oa_hash_new(
-    oa_key_ops key_ops, 
-    oa_val_ops val_ops, 
-    void (*probing_fct)(struct oa_hash_s *htable, size_t *from_idx)) 
-{
-    oa_hash *htable;
-    
-    htable = (oa_hash*)malloc(sizeof(*htable));
-    if (NULL==htable) {
-        fprintf(stderr,"malloc() failed in file %s at line # %d", __FILE__,__LINE__);
-        exit(EXIT_FAILURE);  
-    }
+static size_t oa_hash_find(oa_hash *htable, oa_slots *slots, uint32_t hash_val, const void *key);
 
-    htable->size = 0;
-    htable->capacity = OA_HASH_INIT_CAPACITY;
-    htable->val_ops = val_ops;
-    htable->key_ops = key_ops;
-    htable->probing_fct = probing_fct;
+// Control byte groups, a match is a mask with a bit per slot in the group.
+// the neon mask has 4 bits per slot, so OA_MASK_SHIFT turns a bit back into a slot
 
-    htable->buckets = (oa_pair **)malloc(sizeof(*(htable->buckets)) * htable->capacity);
-    if (NULL==htable->buckets) {
-        fprintf(stderr,"malloc() failed in file %s at line # %d", __FILE__,__LINE__);
-        exit(EXIT_FAILURE);  
-    }
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OA_MASK_SHIFT 0
 
-    for(int i = 0; i < htable->capacity; i++) {
-        htable->buckets[i] = NULL;
-    }
+static inline uint64_t oa_group_match(const uint8_t *ctrl, uint8_t c) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+}
 
-    return htable;
+// empty or deleted, they are the only control bytes with the top bit set
+static inline uint64_t oa_group_free(const uint8_t *ctrl) {
+    return (uint64_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
 }
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OA_MASK_SHIFT 2
 
-oa_hash* oa_hash_new_lp(oa_key_ops key_ops, oa_val_ops val_ops) {
-    return oa_hash_new(key_ops, val_ops, oa_hash_lp_idx);
+static inline uint64_t oa_group_mask(uint8x16_t m) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0) & 0x8888888888888888ULL;
 }
 
-void oa_hash_free(oa_hash *htable) {
-    for(int i = 0; i < htable->capacity; i++) {
-        if (NULL!=htable->buckets[i]) {
-            htable->key_ops.free(htable->buckets[i]->key, htable->key_ops.arg);
-            htable->val_ops.free(htable->buckets[i]->val, htable->val_ops.arg);
-        }
-        free(htable->buckets[i]);
+static inline uint64_t oa_group_match(const uint8_t *ctrl, uint8_t c) {
+    return oa_group_mask(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(c)));
+}
+
+static inline uint64_t oa_group_free(const uint8_t *ctrl) {
+    return oa_group_mask(vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl))));
+}
+#else
+#define OA_MASK_SHIFT 0
+
+static inline uint64_t oa_group_match(const uint8_t *ctrl, uint8_t c) {
+    uint64_t m = 0;
+    for (int i = 0; i < OA_GROUP; i++) {
+        if (ctrl[i] == c) m |= 1ULL << i;
     }
-    free(htable->buckets);
-    free(htable);
+    return m;
 }
 
-inline static void oa_hash_grow(oa_hash *htable) {
-    uint32_t old_capacity;
-    oa_pair **old_buckets;
-    oa_pair *crt_pair;
+static inline uint64_t oa_group_free(const uint8_t *ctrl) {
+    uint64_t m = 0;
+    for (int i = 0; i < OA_GROUP; i++) {
+        if (ctrl[i] & 0x80) m |= 1ULL << i;
+    }
+    return m;
+}
+#endif
 
-    uint64_t new_capacity_64 = (uint64_t) htable->capacity * OA_HASH_GROWTH_FACTOR;
-    if (new_capacity_64 > SIZE_MAX) {
-        fprintf(stderr, "re-size overflow in file %s at line # %d", __FILE__,__LINE__);
+static inline size_t oa_mask_first(uint64_t m) {
+    return (size_t)__builtin_ctzll(m) >> OA_MASK_SHIFT;
+}
+
+// set a slot's control byte, and its copy past the end for the first group
+static inline void oa_slots_set_ctrl(oa_slots *slots, size_t idx, uint8_t c) {
+    slots->ctrl[idx] = c;
+    slots->ctrl[((idx - OA_GROUP) & (slots->capacity - 1)) + OA_GROUP] = c;
+}
+
+static void oa_slots_alloc(oa_slots *slots, size_t capacity) {
+    slots->capacity = capacity;
+    slots->ctrl = (uint8_t*)malloc(capacity + OA_GROUP);
+    slots->pairs = (oa_pair*)malloc(capacity * sizeof(oa_pair));
+    if (NULL==slots->ctrl || NULL==slots->pairs) {
+        fprintf(stderr,"malloc() failed in file %s at line # %d", __FILE__,__LINE__);
         exit(EXIT_FAILURE);
     }
+    memset(slots->ctrl, OA_CTRL_EMPTY, capacity + OA_GROUP);
+}
 
-    old_capacity = htable->capacity;
-    old_buckets = htable->buckets;
+static void oa_slots_release(oa_slots *slots) {
+    free(slots->ctrl);
+    free(slots->pairs);
+    memset(slots, 0, sizeof(oa_slots));
+}
 
-    htable->capacity = (uint32_t) new_capacity_64;
-    htable->size = 0;
-    htable->buckets = (oa_pair **)malloc(htable->capacity * sizeof(*(htable->buckets)));
+// the first free slot on hash_val's probe, there always is one below the load factor
+static size_t oa_slots_find_free(oa_slots *slots, uint32_t hash_val) {
+    size_t mask = slots->capacity - 1;
+    size_t idx = OA_CTRL_H1(hash_val) & mask;
+    uint64_t m;
 
-    if (NULL == htable->buckets) {
+    while ((m = oa_group_free(slots->ctrl + idx)) == 0) {
+        idx = (idx + OA_GROUP) & mask;
+    }
+    return (idx + oa_mask_first(m)) & mask;
+}
+
+// empty out a full slot, the pair is the caller's to free or move. each
+// pair after it up to the next empty slot moves back into the hole when its
+// home isn't between the hole and where it sits, so no probe ever crosses an
+// empty slot to reach its pair
+static void oa_slots_erase(oa_slots *slots, size_t idx) {
+    size_t mask = slots->capacity - 1, home;
+
+    for (size_t j = (idx + 1) & mask; slots->ctrl[j] != OA_CTRL_EMPTY; j = (j + 1) & mask) {
+        home = OA_CTRL_H1(slots->pairs[j].hash) & mask;
+        if (((j - home) & mask) >= ((j - idx) & mask)) {
+            oa_slots_set_ctrl(slots, idx, slots->ctrl[j]);
+            slots->pairs[idx] = slots->pairs[j];
+            idx = j;
+        }
+    }
+    oa_slots_set_ctrl(slots, idx, OA_CTRL_EMPTY);
+}
+
+oa_hash* oa_hash_new(oa_key_ops key_ops, oa_val_ops val_ops) {
+    oa_hash *htable;
+    
+    htable = (oa_hash*)calloc(1, sizeof(*htable));
+    if (NULL==htable) {
         fprintf(stderr,"malloc() failed in file %s at line # %d", __FILE__,__LINE__);
         exit(EXIT_FAILURE);  
     }
 
-    for(int i = 0; i < htable->capacity; i++) {
-        htable->buckets[i] = NULL;
-    };
+    htable->val_ops = val_ops;
+    htable->key_ops = key_ops;
+    oa_slots_alloc(&htable->cur, OA_HASH_INIT_CAPACITY);
+    return htable;
+}
 
-    for(size_t i = 0; i < old_capacity; i++) {
-        crt_pair = old_buckets[i];
-        if (NULL!=crt_pair && !oa_hash_is_tombstone(htable, i)) {
-            oa_hash_put(htable, crt_pair->key, crt_pair->val);
-            htable->key_ops.free(crt_pair->key, htable->key_ops.arg);
-            htable->val_ops.free(crt_pair->val, htable->val_ops.arg);
-            free(crt_pair);
+static void oa_slots_free(oa_hash *htable, oa_slots *slots) {
+    for(size_t i = 0; i < slots->capacity; i++) {
+        if (!(slots->ctrl[i] & 0x80)) {
+            htable->key_ops.free(slots->pairs[i].key, htable->key_ops.arg);
+            htable->val_ops.free(slots->pairs[i].val, htable->val_ops.arg);
         }
     }
+    oa_slots_release(slots);
+}
 
-    free(old_buckets);
+void oa_hash_free(oa_hash *htable) {
+    oa_slots_free(htable, &htable->old);
+    oa_slots_free(htable, &htable->cur);
+    free(htable);
 }
 
-inline static bool oa_hash_should_grow(oa_hash *htable) {
-    return (htable->size / htable->capacity) > OA_HASH_LOAD_FACTOR;
+// move up to count of the old slots into cur. the pairs move as they are,
+// nothing is copied or freed
+static void oa_hash_migrate(oa_hash *htable, size_t count) {
+    oa_slots *old = &htable->old;
+    size_t idx;
+
+    while (count-- > 0 && htable->migrate < old->capacity) {
+        size_t i = htable->migrate++;
+        if (!(old->ctrl[i] & 0x80)) {
+            idx = oa_slots_find_free(&htable->cur, old->pairs[i].hash);
+            oa_slots_set_ctrl(&htable->cur, idx, old->ctrl[i]);
+            htable->cur.pairs[idx] = old->pairs[i];
+            // a tombstone, so a get can't find it twice and the old probes
+            // still run. shifting back here would put pairs behind migrate
+            oa_slots_set_ctrl(old, i, OA_CTRL_DELETED);
+        }
+    }
+    if (old->capacity != 0 && htable->migrate >= old->capacity) oa_slots_release(old);
 }
 
-void oa_hash_put(oa_hash *htable, const void *key, const void *val) {
+// start moving into a table twice the size, a move still going is finished first
+static void oa_hash_grow(oa_hash *htable) {
+    uint64_t new_capacity_64 = (uint64_t) htable->cur.capacity * OA_HASH_GROWTH_FACTOR;
+    size_t new_capacity;
 
-    if (oa_hash_should_grow(htable)) {
-        oa_hash_grow(htable);
+    if (htable->old.capacity != 0) oa_hash_migrate(htable, htable->old.capacity);
+    if (new_capacity_64 > SIZE_MAX / sizeof(oa_pair)) {
+        fprintf(stderr, "re-size overflow in file %s at line # %d", __FILE__,__LINE__);
+        exit(EXIT_FAILURE);
     }
+    new_capacity = (size_t)new_capacity_64;
+    htable->old = htable->cur;
+    htable->migrate = 0;
+    oa_slots_alloc(&htable->cur, new_capacity);
+}
 
-    uint32_t hash_val = htable->key_ops.hash(key, htable->key_ops.arg);
-    size_t idx = hash_val % htable->capacity;
-
-    if (NULL==htable->buckets[idx]) {
-        // Key doesn't exist & we add it anew
-        htable->buckets[idx] = oa_pair_new(
-                hash_val, 
-                htable->key_ops.cp(key, htable->key_ops.arg),
-                htable->val_ops.cp(val, htable->val_ops.arg),
-                htable->key_ops.arg
-        );
-    } else {
-        // // Probing for the next good index
-        idx = oa_hash_getidx(htable, idx, hash_val, key, PUT);
-
-        if (NULL==htable->buckets[idx]) {
-            htable->buckets[idx] = oa_pair_new(
-                hash_val, 
-                htable->key_ops.cp(key, htable->key_ops.arg),
-                htable->val_ops.cp(val, htable->val_ops.arg),
-                htable->key_ops.arg
-            );
-        } else {
-            // Update the existing value
-            // Free the old values
-            htable->val_ops.free(htable->buckets[idx]->val, htable->val_ops.arg);
-            htable->key_ops.free(htable->buckets[idx]->key, htable->key_ops.arg);
-            // Update the new values
-            htable->buckets[idx]->val = htable->val_ops.cp(val, htable->val_ops.arg);
-            htable->buckets[idx]->key = htable->val_ops.cp(key, htable->key_ops.arg);
-            htable->buckets[idx]->hash = hash_val;
-        }
-   }
-    htable->size++;
+// every pair ends up in cur, so it has to have room for the old ones too.
+// the sum is compared in floating point, so it fires at the load factor and
+// not only once the table is full
+inline static bool oa_hash_should_grow(oa_hash *htable) {
+    return (double)(htable->size + 1) > (double)htable->cur.capacity * OA_HASH_LOAD_FACTOR;
 }
 
-inline static bool oa_hash_is_tombstone(oa_hash *htable, size_t idx) {
-    if (NULL==htable->buckets[idx]) {
-        return false;
+// the slot holding key, or capacity when it isn't in slots
+static size_t oa_hash_find(oa_hash *htable, oa_slots *slots, uint32_t hash_val, const void *key) {
+    size_t mask = slots->capacity - 1;
+    size_t idx = OA_CTRL_H1(hash_val) & mask;
+    uint8_t h2 = OA_CTRL_H2(hash_val);
+    uint64_t m;
+    oa_pair *pair;
+
+    if (slots->capacity == 0) return 0;
+    for (;;) {
+        m = oa_group_match(slots->ctrl + idx, h2);
+        while (m != 0) {
+            pair = &slots->pairs[(idx + oa_mask_first(m)) & mask];
+            if (pair->hash == hash_val && htable->key_ops.eq(key, pair->key, htable->key_ops.arg)) {
+                return pair - slots->pairs;
+            }
+            m &= m - 1;
+        }
+        // an empty slot ends the probe, the key would have gone there
+        if (oa_group_match(slots->ctrl + idx, OA_CTRL_EMPTY) != 0) return slots->capacity;
+        idx = (idx + OA_GROUP) & mask;
     }
-    if (NULL==htable->buckets[idx]->key && 
-        NULL==htable->buckets[idx]->val && 
-        0 == htable->buckets[idx]->key) {
-            return true;
-    }        
-    return false;
 }
 
-inline static void oa_hash_put_tombstone(oa_hash *htable, size_t idx) {
-    if (NULL != htable->buckets[idx]) {
-        htable->buckets[idx]->hash = 0;
-        htable->buckets[idx]->key = NULL;
-        htable->buckets[idx]->val = NULL;
+// the pair for key in either set of slots, or NULL
+static oa_pair *oa_hash_lookup(oa_hash *htable, uint32_t hash_val, const void *key, oa_slots **in) {
+    oa_slots *slots[2] = { &htable->cur, &htable->old };
+    size_t idx;
+
+    for (int i = 0; i < 2; i++) {
+        idx = oa_hash_find(htable, slots[i], hash_val, key);
+        if (idx < slots[i]->capacity) {
+            if (in != NULL) *in = slots[i];
+            return &slots[i]->pairs[idx];
+        }
     }
+    return NULL;
 }
 
-void *oa_hash_get(oa_hash *htable, const void *key) {
+void oa_hash_put(oa_hash *htable, const void *key, const void *val) {
     uint32_t hash_val = htable->key_ops.hash(key, htable->key_ops.arg);
-    size_t idx = hash_val % htable->capacity;
+    oa_pair *pair;
+    size_t idx;
+
+    oa_hash_migrate(htable, OA_HASH_MIGRATE_STEP);
+    pair = oa_hash_lookup(htable, hash_val, key, NULL);
+    if (pair != NULL) {
+        // Update the existing value, the key stays
+        htable->val_ops.free(pair->val, htable->val_ops.arg);
+        pair->val = htable->val_ops.cp(val, htable->val_ops.arg);
+        return;
+    }
 
-    if (NULL==htable->buckets[idx]) {
-        return NULL;
+    if (oa_hash_should_grow(htable)) {
+        oa_hash_grow(htable);
     }
+    idx = oa_slots_find_free(&htable->cur, hash_val);
+    oa_slots_set_ctrl(&htable->cur, idx, OA_CTRL_H2(hash_val));
+    pair = &htable->cur.pairs[idx];
+    pair->hash = hash_val;
+    pair->key = htable->key_ops.cp(key, htable->key_ops.arg);
+    pair->val = htable->val_ops.cp(val, htable->val_ops.arg);
+    htable->size++;
+}
 
-    idx = oa_hash_getidx(htable, idx, hash_val, key, GET);
+void *oa_hash_get(oa_hash *htable, const void *key) {
+    uint32_t hash_val = htable->key_ops.hash(key, htable->key_ops.arg);
+    oa_pair *pair = oa_hash_lookup(htable, hash_val, key, NULL);
 
-    return (NULL==htable->buckets[idx]) ?
-         NULL : htable->buckets[idx]->val;
+    return (pair != NULL) ? pair->val : NULL;
 }
 
 void oa_hash_delete(oa_hash *htable, const void *key) {
     uint32_t hash_val = htable->key_ops.hash(key, htable->key_ops.arg);
-    size_t idx = hash_val % htable->capacity;
+    oa_slots *slots;
+    oa_pair *pair;
     
-    if (NULL==htable->buckets[idx]) {
+    oa_hash_migrate(htable, OA_HASH_MIGRATE_STEP);
+    pair = oa_hash_lookup(htable, hash_val, key, &slots);
+    if (pair == NULL) {
         return;
     }
 
-    idx = oa_hash_getidx(htable, idx, hash_val, key, REMOVE);
-    if (NULL==htable->buckets[idx]) {
-        return;
+    htable->val_ops.free(pair->val, htable->val_ops.arg);
+    htable->key_ops.free(pair->key, htable->key_ops.arg);
+    htable->size--;
+    if (slots == &htable->cur) {
+        oa_slots_erase(slots, pair - slots->pairs);
+    } else {
+        oa_slots_set_ctrl(slots, pair - slots->pairs, OA_CTRL_DELETED);
     }
-
-    htable->val_ops.free(htable->buckets[idx]->val, htable->val_ops.arg);
-    htable->key_ops.free(htable->buckets[idx]->key, htable->key_ops.arg);
-
-    oa_hash_put_tombstone(htable, idx);
 }
 
-void oa_hash_print(oa_hash *htable, void (*print_key)(const void *k), void (*print_val)(const void *v)) {
+static void oa_slots_print(oa_slots *slots, void (*print_key)(const void *k), void (*print_val)(const void *v)) {
     oa_pair *pair;
 
-    printf("Hash Capacity: %llu\n", htable->capacity);
-    printf("Hash Size: %llu\n", htable->size);
-
-    printf("Hash Buckets:\n");
-    for(int i = 0; i < htable->capacity; i++) {
-        pair = htable->buckets[i];
-        printf("\tbucket[%d]:\n", i);
-        if (NULL!=pair) {
-            if (oa_hash_is_tombstone(htable, i)) {
-                printf("\t\t TOMBSTONE");
-            } else {
-                printf("\t\thash=%08X, key=", pair->hash);
-                print_key(pair->key);
-                printf(", value=");
-                print_val(pair->val);
-            }
+    for(size_t i = 0; i < slots->capacity; i++) {
+        pair = &slots->pairs[i];
+        printf("\tbucket[%zu]:\n", i);
+        if (slots->ctrl[i] == OA_CTRL_DELETED) {
+            printf("\t\t TOMBSTONE");
+        } else if (slots->ctrl[i] != OA_CTRL_EMPTY) {
+            printf("\t\thash=%08X, key=", pair->hash);
+            print_key(pair->key);
+            printf(", value=");
+            print_val(pair->val);
         }
         printf("\n");
     }
 }
-static size_t oa_hash_getidx(oa_hash *htable, size_t idx, uint32_t hash_val, const void *key, enum oa_ret_ops op) {
-    do {
-        if (op==PUT && oa_hash_is_tombstone(htable, idx)) {
-            break;
-        }
-        if (htable->buckets[idx]->hash == hash_val && 
-            htable->key_ops.eq(key, htable->buckets[idx]->key, htable->key_ops.arg)) {
-            break;
-        }
-        htable->probing_fct(htable, &idx);
-    } while(NULL!=htable->buckets[idx]);
-    return idx;
-}
-
-// Probing functions
-
-static inline void oa_hash_lp_idx(oa_hash *htable, size_t *idx) {
-    (*idx)++;
-    if ((*idx)==htable->capacity) {
-        (*idx) = 0;
-    }
-}
 
-// Pair related
+void oa_hash_print(oa_hash *htable, void (*print_key)(const void *k), void (*print_val)(const void *v)) {
+    printf("Hash Capacity: %zu\n", htable->cur.capacity);
+    printf("Hash Size: %zu\n", htable->size);
 
-oa_pair *oa_pair_new(uint32_t hash, const void *key, const void *val, void *arg) {
-    oa_pair *p;
-    p = (oa_pair*)malloc(sizeof(*p));
-    if (NULL==p) {
-        wrxError((wrxState*)arg, "malloc() failed in file %s at line # %d", __FILE__,__LINE__);
-        exit(EXIT_FAILURE);  
+    printf("Hash Buckets:\n");
+    oa_slots_print(&htable->cur, print_key, print_val);
+    if (htable->old.capacity != 0) {
+        printf("Moving From (%zu of %zu done):\n", htable->migrate, htable->old.capacity);
+        oa_slots_print(&htable->old, print_key, print_val);
     }
-    p->hash = hash;
-    p->val = (void*) val;
-    p->key = (void*) key;
-    return p;
 }
 
 // String operations
@@ -377,19 +451,83 @@ void oa_string_print(const void *data) {
     printf("%s", (const char*) data);
 }
 
+// a table's infos come out of slabs of DWRX_INFO_SLAB at a time. freed ones
+// go on a list for the next put, and the slabs only go back when the table
+// is freed, so a put or delete costs no malloc for the info itself and the
+// infos of a table sit close together
+#define DWRX_INFO_SLAB      256
+
+typedef union dwrxInfoSlot {
+    union dwrxInfoSlot *next;
+    wrxInfo info;
+} dwrxInfoSlot;
+
+typedef struct dwrxInfoSlab {
+    struct dwrxInfoSlab *next;
+    dwrxInfoSlot slot[DWRX_INFO_SLAB];
+} dwrxInfoSlab;
+
+// infos a shared table let go of, readers may still be looking at them
+typedef struct {
+    wrxInfo *v;
+    unsigned long long retired;     // the epoch it was let go in
+} dwrxLimboEntry;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    dwrxLimboEntry *entry;
+} dwrxInfoLimbo;
+
+typedef struct {
+    wrxState *p;
+    dwrxInfoSlot *free;
+    dwrxInfoSlab *slabs;
+    size_t used;                // slots handed out of the newest slab
+    dwrxInfoLimbo *limbo;       // when set, freed infos wait here instead
+} dwrxInfoHeap;
+
+static wrxInfo *dwrxInfoAlloc(dwrxInfoHeap *h) {
+    dwrxInfoSlot *s = h->free;
+    dwrxInfoSlab *k;
+
+    if (s != NULL) {
+        h->free = s->next;
+        return &s->info;
+    }
+    if (h->slabs == NULL || h->used == DWRX_INFO_SLAB) {
+        k = (dwrxInfoSlab*)malloc(sizeof(dwrxInfoSlab));
+        if (k == NULL) return NULL;
+        k->next = h->slabs;
+        h->slabs = k;
+        h->used = 0;
+    }
+    return &h->slabs->slot[h->used++].info;
+}
+
+static void dwrxInfoRelease(dwrxInfoHeap *h, wrxInfo *v) {
+    dwrxInfoSlot *s = (dwrxInfoSlot*)v;
+
+    s->next = h->free;
+    h->free = s;
+}
+
 void* oa_data_cp(const void *data, void *arg) {
 	const wrxInfo *p = (wrxInfo*)data;
-	wrxInfo *ret = (wrxInfo*)malloc(sizeof(wrxInfo));
+	dwrxInfoHeap *h = (dwrxInfoHeap*)arg;
+	wrxInfo *ret = dwrxInfoAlloc(h);
 	if (ret == NULL) {
-		wrxError((wrxState*)arg, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
+		wrxError(h->p, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
 		return NULL;
 	}
 	memcpy(ret, p, sizeof(wrxInfo));
     switch (p->form) {
         case WRX_FORM_DATA:
+        case WRX_FORM_TABLE:
                 ret->data.memory = malloc(p->data.bytes);
                 if (ret->data.memory == NULL) {
-                    wrxError((wrxState*)arg, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
+                    dwrxInfoRelease(h, ret);
+                    wrxError(h->p, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
                     return NULL;
                 }
                 memcpy(ret->data.memory, p->data.memory, p->data.bytes);
@@ -397,13 +535,17 @@ void* oa_data_cp(const void *data, void *arg) {
         case WRX_FORM_MEMIO:
                 ret->io.mem = (char*)malloc(p->io.length);
                 if (ret->io.mem == NULL) {
-                    wrxError((wrxState*)arg, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
+                    dwrxInfoRelease(h, ret);
+                    wrxError(h->p, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
                     return NULL;
                 }
                 memcpy(ret->io.mem, p->io.mem, p->io.length);
             break;
-        case WRX_FORM_TABLE:
-            // TODO
+        case WRX_FORM_BLOB:
+                dwrxRetainBlob((wrxBlob*)p->p);
+            break;
+        case WRX_FORM_CHANNEL:
+                wrxRetainChannel((wrxChannel*)p->p);
             break;
     }
 	
@@ -412,13 +554,582 @@ void* oa_data_cp(const void *data, void *arg) {
 
 void oa_data_free(void *data, void *arg) {
 	wrxInfo *p = (wrxInfo*)data;
-    dwrxFreeInfo(p);
+    dwrxInfoHeap *h = (dwrxInfoHeap*)arg;
+    dwrxInfoLimbo *l = h->limbo;
+    size_t capacity;
+    dwrxLimboEntry *e;
+
+    if (p == NULL) return;
+    if (l != NULL) {
+        if (l->count == l->capacity) {
+            capacity = (l->capacity != 0) ? l->capacity * 2 : 64;
+            e = (dwrxLimboEntry*)realloc(l->entry, capacity * sizeof(dwrxLimboEntry));
+            if (e == NULL) {
+                // a reader could still have it, so it can only leak
+                wrxError(h->p, "malloc() failed in file %s at line # %d", __FILE__, __LINE__);
+                return;
+            }
+            l->entry = e;
+            l->capacity = capacity;
+        }
+        l->entry[l->count].v = p;
+        l->entry[l->count].retired = xatomic_load(&h->p->epoch);
+        l->count++;
+        return;
+    }
+    dwrxClearInfo(p);
+    dwrxInfoRelease(h, p);
 }
 
 
 oa_key_ops oa_key_ops_string = { oa_string_hash, oa_string_cp, oa_string_free, oa_string_eq, NULL};
 oa_val_ops oa_val_ops_data = { oa_data_cp, oa_data_free, NULL};
 
+// *****************************************************************************
+// interned names, one copy of each string for as long as something holds it.
+// equal names are the same pointer, and each carries its hash, length and
+// count of holders just in front of it. finding a name takes no lock. adding
+// one takes a spin lock, which is rare once an app has warmed up. the index is
+// split by the top bits of the hash so growing it only ever rehashes one small
+// piece.
+// a name nobody holds is unlinked by dwrxReclaimNames(), one shard a frame,
+// and its memory is reused once every thread's epoch pin has passed. so a
+// name from dwrxInterned() is good until the thread lets go of its pin, and
+// one from dwrxIntern() until it is handed to dwrxNameRelease()
+#define DWRX_NAME_CHUNK     (64 * 1024)
+#define DWRX_NAME_SMALL     256                 // bigger names get a malloc() of their own
+#define DWRX_NAME_SHARDS    256
+#define DWRX_NAME_SHARD(h)  ((h) >> 24)
+#define DWRX_NAME_DEAD      0x80000000u         // in refs once unlinked, it can't be held again
+#define DWRX_NAME_GONE      ((dwrxName*)1)      // an index slot whose name was unlinked
+
+typedef struct dwrxName_s {
+    uint32_t hash;
+    uint32_t length;
+    uint32_t refs;
+    char str[];
+} dwrxName;
+
+// never more than half full, unlinked slots included. a replaced index waits
+// in limbo with the unlinked names, because a reader may still be probing it
+typedef struct dwrxNameIndex_s {
+    size_t capacity;
+    size_t gone;
+    dwrxName *slot[];
+} dwrxNameIndex;
+
+typedef struct dwrxNameChunk_s {
+    struct dwrxNameChunk_s *next;
+    char mem[];
+} dwrxNameChunk;
+
+// in the order they were let go of. retired is 0 until the next
+// dwrxReclaimNames() stamps it, so the stamps only ever go up from the head
+typedef struct {
+    void *gone;
+    int index;
+    unsigned long long retired;
+} dwrxNameLimbo;
+
+static int dwrxNameLock;
+static dwrxNameIndex *dwrxNameTable[DWRX_NAME_SHARDS];
+static size_t dwrxNameCount[DWRX_NAME_SHARDS];
+static dwrxNameChunk *dwrxNameChunks;
+static char *dwrxNameBump, *dwrxNameEnd;
+static dwrxName *dwrxNameFree[DWRX_NAME_SMALL / 8];    // reusable records by size
+static dwrxNameLimbo *dwrxNameRetired;
+static size_t dwrxNameRetiredHead, dwrxNameRetiredStamped, dwrxNameRetiredCount, dwrxNameRetiredSize;
+static int dwrxNameSweep;                               // the shard to look at next
+
+static dwrxName *dwrxNameFind(dwrxNameIndex *x, const char *s, uint32_t hash, uint32_t length) {
+    dwrxName *n;
+
+    if (x == NULL) return NULL;
+    for (size_t i = hash & (x->capacity - 1); ; i = (i + 1) & (x->capacity - 1)) {
+        n = xatomic_load(&x->slot[i]);
+        if (n == NULL) return NULL;
+        if (n != DWRX_NAME_GONE && n->hash == hash && n->length == length && !memcmp(n->str, s, length)) return n;
+    }
+}
+
+static void dwrxNamePlace(dwrxNameIndex *x, dwrxName *n) {
+    size_t i = n->hash & (x->capacity - 1);
+
+    while (x->slot[i] != NULL) i = (i + 1) & (x->capacity - 1);
+    // the name is filled in before a reader can find it
+    xatomic_store(&x->slot[i], n);
+}
+
+static size_t dwrxNameBytes(uint32_t length) {
+    return (sizeof(dwrxName) + length + 1 + 7) & ~(size_t)7;
+}
+
+// room for a new name, a freed one of the same size or carved from the current chunk
+static dwrxName *dwrxNameAlloc(uint32_t length) {
+    size_t bytes = dwrxNameBytes(length);
+    dwrxNameChunk *k;
+    dwrxName *n;
+
+    if (bytes > DWRX_NAME_SMALL) return (dwrxName*)malloc(bytes);
+    if ((n = dwrxNameFree[bytes / 8 - 1]) != NULL) {
+        memcpy(&dwrxNameFree[bytes / 8 - 1], n, sizeof(dwrxName*));
+        return n;
+    }
+    if (dwrxNameBump == NULL || bytes > (size_t)(dwrxNameEnd - dwrxNameBump)) {
+        k = (dwrxNameChunk*)malloc(sizeof(dwrxNameChunk) + DWRX_NAME_CHUNK);
+        if (k == NULL) return NULL;
+        k->next = dwrxNameChunks;
+        dwrxNameChunks = k;
+        dwrxNameBump = k->mem;
+        dwrxNameEnd = k->mem + DWRX_NAME_CHUNK;
+    }
+    n = (dwrxName*)dwrxNameBump;
+    dwrxNameBump += bytes;
+    return n;
+}
+
+// a name no reader can reach anymore, its record goes back for reuse
+static void dwrxNameDrop(dwrxName *n) {
+    size_t bytes = dwrxNameBytes(n->length);
+
+    if (bytes > DWRX_NAME_SMALL) {
+        free(n);
+        return;
+    }
+    memcpy(n, &dwrxNameFree[bytes / 8 - 1], sizeof(dwrxName*));
+    dwrxNameFree[bytes / 8 - 1] = n;
+}
+
+// room for one more in limbo, under the lock
+static int dwrxNameLimboRoom() {
+    size_t size;
+    dwrxNameLimbo *l;
+
+    if (dwrxNameRetiredCount < dwrxNameRetiredSize) return WRX_OK;
+    if (dwrxNameRetiredHead != 0) {
+        // slide what is left down over what was freed
+        memmove(dwrxNameRetired, dwrxNameRetired + dwrxNameRetiredHead, (dwrxNameRetiredCount - dwrxNameRetiredHead) * sizeof(dwrxNameLimbo));
+        dwrxNameRetiredStamped -= dwrxNameRetiredHead;
+        dwrxNameRetiredCount -= dwrxNameRetiredHead;
+        dwrxNameRetiredHead = 0;
+        if (dwrxNameRetiredCount * 2 <= dwrxNameRetiredSize) return WRX_OK;
+    }
+    size = (dwrxNameRetiredSize != 0) ? dwrxNameRetiredSize * 2 : 64;
+    l = (dwrxNameLimbo*)realloc(dwrxNameRetired, size * sizeof(dwrxNameLimbo));
+    if (l == NULL) return WRX_ERR;
+    dwrxNameRetired = l;
+    dwrxNameRetiredSize = size;
+    return WRX_OK;
+}
+
+static void dwrxNameRetire(void *gone, int index) {
+    dwrxNameLimbo *l = &dwrxNameRetired[dwrxNameRetiredCount++];
+
+    l->gone = gone;
+    l->index = index;
+    l->retired = 0;
+}
+
+// a fresh index for shard with room for one more name and none of the
+// unlinked slots, the old one goes to limbo. under the lock
+static dwrxNameIndex *dwrxNameRebuild(int shard) {
+    dwrxNameIndex *x = dwrxNameTable[shard], *nx;
+    size_t capacity = 16;
+
+    if (x != NULL && dwrxNameLimboRoom() != WRX_OK) return NULL;
+    while (capacity < (dwrxNameCount[shard] + 1) * 4) capacity *= 2;
+    nx = (dwrxNameIndex*)calloc(1, sizeof(dwrxNameIndex) + capacity * sizeof(dwrxName*));
+    if (nx == NULL) return NULL;
+    nx->capacity = capacity;
+    for (size_t i = 0; x != NULL && i < x->capacity; i++) {
+        if (x->slot[i] != NULL && x->slot[i] != DWRX_NAME_GONE) dwrxNamePlace(nx, x->slot[i]);
+    }
+    xatomic_store(&dwrxNameTable[shard], nx);
+    if (x != NULL) dwrxNameRetire(x, 1);
+    return nx;
+}
+
+// hold n, unless it was unlinked after we found it
+static int dwrxNameHold(dwrxName *n) {
+    uint32_t refs = xatomic_load_relaxed(&n->refs);
+
+    while (!(refs & DWRX_NAME_DEAD)) {
+        if (xatomic_cas(&n->refs, &refs, refs + 1)) return 1;
+    }
+    return 0;
+}
+
+static dwrxName *dwrxNameOf(const char *name) {
+    return (dwrxName*)(name - offsetof(dwrxName, str));
+}
+
+// the interned copy of s, or NULL when it isn't interned. it isn't held, see above
+const char *dwrxInterned(const char *s) {
+    uint32_t hash = oa_string_hash(s, NULL);
+    dwrxName *n = dwrxNameFind(xatomic_load(&dwrxNameTable[DWRX_NAME_SHARD(hash)]), s, hash, (uint32_t)strlen(s));
+
+    return (n != NULL) ? n->str : NULL;
+}
+
+// the interned copy of s, added on first use and held for the caller until
+// dwrxNameRelease(). NULL only when out of memory
+const char *dwrxIntern(const char *s) {
+    uint32_t hash = oa_string_hash(s, NULL);
+    uint32_t length = (uint32_t)strlen(s);
+    int shard = DWRX_NAME_SHARD(hash);
+    dwrxNameIndex *x = xatomic_load(&dwrxNameTable[shard]);
+    dwrxName *n = dwrxNameFind(x, s, hash, length);
+
+    if (n != NULL && dwrxNameHold(n)) return n->str;
+    while (xatomic_swap(&dwrxNameLock, 1)) { }
+    // someone may have added it, or unlinked it, while we waited. names are
+    // only unlinked under the lock, so one found here can't be dead
+    x = dwrxNameTable[shard];
+    n = dwrxNameFind(x, s, hash, length);
+    if (n != NULL) {
+        xatomic_add(&n->refs, 1);
+    } else {
+        if (x == NULL || (dwrxNameCount[shard] + x->gone + 1) * 2 > x->capacity) x = dwrxNameRebuild(shard);
+        if (x != NULL && (n = dwrxNameAlloc(length)) != NULL) {
+            n->hash = hash;
+            n->length = length;
+            n->refs = 1;
+            memcpy(n->str, s, length + 1);
+            dwrxNamePlace(x, n);
+            dwrxNameCount[shard]++;
+        }
+    }
+    xatomic_store(&dwrxNameLock, 0);
+    return (n != NULL) ? n->str : NULL;
+}
+
+// another hold on a name the caller already holds
+void dwrxNameRetain(const char *name) {
+    xatomic_add(&dwrxNameOf(name)->refs, 1);
+}
+
+void dwrxNameRelease(const char *name) {
+    xatomic_sub(&dwrxNameOf(name)->refs, 1);
+}
+
+// the hash kept with a name from dwrxIntern() or dwrxInterned()
+unsigned int dwrxNameHash(const char *name) {
+    return dwrxNameOf(name)->hash;
+}
+
+// the hash s has, or would have, as a name
+unsigned int dwrxStringHash(const char *s) {
+    return oa_string_hash(s, NULL);
+}
+
+// on the main thread once a frame, see wrxPublishShares(). reuses what was
+// unlinked before oldest, then unlinks the names nobody holds in the next shard
+void dwrxReclaimNames(wrxState *p, unsigned long long oldest) {
+    unsigned long long epoch = xatomic_load(&p->epoch);
+    dwrxNameLimbo *l;
+    dwrxNameIndex *x;
+    dwrxName *n;
+    uint32_t zero;
+    int shard;
+
+    while (xatomic_swap(&dwrxNameLock, 1)) { }
+    // let go of since the last look, so the pins can only be checked from now on
+    for (; dwrxNameRetiredStamped < dwrxNameRetiredCount; dwrxNameRetiredStamped++) {
+        dwrxNameRetired[dwrxNameRetiredStamped].retired = epoch;
+    }
+    for (; dwrxNameRetiredHead < dwrxNameRetiredCount; dwrxNameRetiredHead++) {
+        l = &dwrxNameRetired[dwrxNameRetiredHead];
+        if (l->retired >= oldest) break;
+        if (l->index) free(l->gone);
+            else dwrxNameDrop((dwrxName*)l->gone);
+    }
+    if (dwrxNameRetiredHead == dwrxNameRetiredCount) dwrxNameRetiredHead = dwrxNameRetiredStamped = dwrxNameRetiredCount = 0;
+
+    shard = dwrxNameSweep;
+    dwrxNameSweep = (shard + 1) % DWRX_NAME_SHARDS;
+    x = dwrxNameTable[shard];
+    for (size_t i = 0; x != NULL && i < x->capacity; i++) {
+        n = x->slot[i];
+        if (n == NULL || n == DWRX_NAME_GONE || xatomic_load_relaxed(&n->refs) != 0) continue;
+        if (dwrxNameLimboRoom() != WRX_OK) break;
+        // a reader holding it right now wins, and it stays
+        zero = 0;
+        if (!xatomic_cas(&n->refs, &zero, DWRX_NAME_DEAD)) continue;
+        xatomic_store(&x->slot[i], DWRX_NAME_GONE);
+        x->gone++;
+        dwrxNameCount[shard]--;
+        dwrxNameRetire(n, 0);
+    }
+    // unlinked slots still make probes walk, so too many of them start it over
+    if (x != NULL && x->gone > x->capacity / 4) dwrxNameRebuild(shard);
+    xatomic_store(&dwrxNameLock, 0);
+}
+
+// every name goes, nothing may use one after this
+static void dwrxFreeNames() {
+    dwrxNameIndex *x;
+    dwrxNameChunk *k;
+
+    for (size_t i = dwrxNameRetiredHead; i < dwrxNameRetiredCount; i++) {
+        if (dwrxNameRetired[i].index) free(dwrxNameRetired[i].gone);
+            else dwrxNameDrop((dwrxName*)dwrxNameRetired[i].gone);
+    }
+    free(dwrxNameRetired);
+    dwrxNameRetired = NULL;
+    dwrxNameRetiredHead = dwrxNameRetiredStamped = dwrxNameRetiredCount = dwrxNameRetiredSize = 0;
+    for (int i = 0; i < DWRX_NAME_SHARDS; i++) {
+        if ((x = dwrxNameTable[i]) == NULL) continue;
+        // the big ones aren't in a chunk
+        for (size_t j = 0; j < x->capacity; j++) {
+            if (x->slot[j] != NULL && x->slot[j] != DWRX_NAME_GONE) dwrxNameDrop(x->slot[j]);
+        }
+        free(x);
+        dwrxNameTable[i] = NULL;
+        dwrxNameCount[i] = 0;
+    }
+    while ((k = dwrxNameChunks) != NULL) {
+        dwrxNameChunks = k->next;
+        free(k);
+    }
+    memset(dwrxNameFree, 0, sizeof(dwrxNameFree));
+    dwrxNameBump = dwrxNameEnd = NULL;
+    dwrxNameSweep = 0;
+}
+
+// table keys are interned names, so they hash for free and compare as pointers
+uint32_t oa_name_hash(const void *data, void *arg) {
+    return dwrxNameHash((const char*)data);
+}
+
+// the table holds its keys
+void* oa_name_cp(const void *data, void *arg) {
+    dwrxNameRetain((const char*)data);
+    return (void*)data;
+}
+
+bool oa_name_eq(const void *data1, const void *data2, void *arg) {
+    return data1 == data2;
+}
+
+void oa_name_free(void *data, void *arg) {
+    dwrxNameRelease((const char*)data);
+}
+
+oa_key_ops oa_key_ops_name = { oa_name_hash, oa_name_cp, oa_name_free, oa_name_eq, NULL};
+
+// *****************************************************************************
+// an ordered index of a table's names, a b+ tree with every name in its
+// leaves and the leaves chained in order. it sits next to the hash so a
+// prefix or a range of names can be walked in order, touching only the names
+// it yields and the path down to the first one. an inner node keeps the
+// smallest name under each child but the first, a leaf keeps the info too
+#define DWRX_ORDER_FANOUT   32
+#define DWRX_ORDER_MIN      (DWRX_ORDER_FANOUT / 4)
+
+typedef struct dwrxOrderNode {
+    int leaf;
+    int count;
+    struct dwrxOrderNode *next;     // the next leaf, leaves only
+    const char *key[DWRX_ORDER_FANOUT];
+    union {
+        struct dwrxOrderNode *child[DWRX_ORDER_FANOUT];
+        wrxInfo *val[DWRX_ORDER_FANOUT];
+    };
+} dwrxOrderNode;
+
+typedef struct {
+    dwrxOrderNode *root;
+} dwrxOrder;
+
+static dwrxOrderNode *dwrxOrderNewNode(int leaf) {
+    dwrxOrderNode *n = (dwrxOrderNode*)calloc(1, sizeof(dwrxOrderNode));
+    if (n == NULL) {
+        fprintf(stderr,"malloc() failed in file %s at line # %d", __FILE__,__LINE__);
+        exit(EXIT_FAILURE);
+    }
+    n->leaf = leaf;
+    return n;
+}
+
+// the first slot in a leaf at or after name
+static int dwrxOrderLeafAt(dwrxOrderNode *n, const char *name) {
+    int lo = 0, hi = n->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strcmp(n->key[mid], name) < 0) lo = mid + 1;
+            else hi = mid;
+    }
+    return lo;
+}
+
+// the child of an inner node that name falls under
+static int dwrxOrderChildAt(dwrxOrderNode *n, const char *name) {
+    int lo = 1, hi = n->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strcmp(n->key[mid], name) <= 0) lo = mid + 1;
+            else hi = mid;
+    }
+    return lo - 1;
+}
+
+// the right half when n split, which the caller links in after n
+static dwrxOrderNode *dwrxOrderInsert(dwrxOrderNode *n, const char *name, wrxInfo *v) {
+    dwrxOrderNode *r, *split;
+    int i, half;
+
+    if (n->leaf) {
+        i = dwrxOrderLeafAt(n, name);
+        if (i < n->count && n->key[i] == name) {
+            n->val[i] = v;
+            return NULL;
+        }
+        memmove(&n->key[i + 1], &n->key[i], (n->count - i) * sizeof(n->key[0]));
+        memmove(&n->val[i + 1], &n->val[i], (n->count - i) * sizeof(n->val[0]));
+        n->key[i] = name;
+        n->val[i] = v;
+    } else {
+        i = dwrxOrderChildAt(n, name);
+        if ((split = dwrxOrderInsert(n->child[i], name, v)) == NULL) return NULL;
+        i++;
+        memmove(&n->key[i + 1], &n->key[i], (n->count - i) * sizeof(n->key[0]));
+        memmove(&n->child[i + 1], &n->child[i], (n->count - i) * sizeof(n->child[0]));
+        n->key[i] = split->key[0];
+        n->child[i] = split;
+    }
+    if (++n->count < DWRX_ORDER_FANOUT) return NULL;
+
+    // full, the top half moves out to a new node
+    half = n->count / 2;
+    r = dwrxOrderNewNode(n->leaf);
+    r->count = n->count - half;
+    memcpy(r->key, &n->key[half], r->count * sizeof(n->key[0]));
+    if (n->leaf) {
+        memcpy(r->val, &n->val[half], r->count * sizeof(n->val[0]));
+        r->next = n->next;
+        n->next = r;
+    } else {
+        memcpy(r->child, &n->child[half], r->count * sizeof(n->child[0]));
+    }
+    n->count = half;
+    return r;
+}
+
+// child i of n has gone under DWRX_ORDER_MIN, take from a neighbour or merge with it
+static void dwrxOrderRebalance(dwrxOrderNode *n, int i) {
+    int li = (i > 0) ? i - 1 : i, move;
+    dwrxOrderNode *l = n->child[li], *r = n->child[li + 1];
+
+    // the first key of an inner node isn't kept up, the parent's is the real one
+    if (!l->leaf) r->key[0] = n->key[li + 1];
+    if (l->count + r->count < DWRX_ORDER_FANOUT) {
+        memcpy(&l->key[l->count], r->key, r->count * sizeof(r->key[0]));
+        if (l->leaf) {
+            memcpy(&l->val[l->count], r->val, r->count * sizeof(r->val[0]));
+            l->next = r->next;
+        } else {
+            memcpy(&l->child[l->count], r->child, r->count * sizeof(r->child[0]));
+        }
+        l->count += r->count;
+        free(r);
+        n->count--;
+        memmove(&n->key[li + 1], &n->key[li + 2], (n->count - li - 1) * sizeof(n->key[0]));
+        memmove(&n->child[li + 1], &n->child[li + 2], (n->count - li - 1) * sizeof(n->child[0]));
+        return;
+    }
+
+    // even them out
+    move = (l->count + r->count) / 2 - l->count;
+    if (move > 0) {
+        memcpy(&l->key[l->count], r->key, move * sizeof(r->key[0]));
+        memmove(r->key, &r->key[move], (r->count - move) * sizeof(r->key[0]));
+        if (l->leaf) {
+            memcpy(&l->val[l->count], r->val, move * sizeof(r->val[0]));
+            memmove(r->val, &r->val[move], (r->count - move) * sizeof(r->val[0]));
+        } else {
+            memcpy(&l->child[l->count], r->child, move * sizeof(r->child[0]));
+            memmove(r->child, &r->child[move], (r->count - move) * sizeof(r->child[0]));
+        }
+    } else {
+        move = -move;
+        memmove(&r->key[move], r->key, r->count * sizeof(r->key[0]));
+        memcpy(r->key, &l->key[l->count - move], move * sizeof(r->key[0]));
+        if (l->leaf) {
+            memmove(&r->val[move], r->val, r->count * sizeof(r->val[0]));
+            memcpy(r->val, &l->val[l->count - move], move * sizeof(r->val[0]));
+        } else {
+            memmove(&r->child[move], r->child, r->count * sizeof(r->child[0]));
+            memcpy(r->child, &l->child[l->count - move], move * sizeof(r->child[0]));
+        }
+        move = -move;
+    }
+    l->count += move;
+    r->count -= move;
+    n->key[li + 1] = r->key[0];
+}
+
+// true when name was there and is gone
+static bool dwrxOrderRemove(dwrxOrderNode *n, const char *name) {
+    int i;
+
+    if (n->leaf) {
+        i = dwrxOrderLeafAt(n, name);
+        if (i >= n->count || n->key[i] != name) return false;
+        n->count--;
+        memmove(&n->key[i], &n->key[i + 1], (n->count - i) * sizeof(n->key[0]));
+        memmove(&n->val[i], &n->val[i + 1], (n->count - i) * sizeof(n->val[0]));
+        return true;
+    }
+    i = dwrxOrderChildAt(n, name);
+    if (!dwrxOrderRemove(n->child[i], name)) return false;
+    if (n->child[i]->count < DWRX_ORDER_MIN && n->count > 1) dwrxOrderRebalance(n, i);
+    return true;
+}
+
+static void dwrxOrderPut(dwrxOrder *o, const char *name, wrxInfo *v) {
+    dwrxOrderNode *split, *root;
+
+    if (o->root == NULL) o->root = dwrxOrderNewNode(1);
+    if ((split = dwrxOrderInsert(o->root, name, v)) != NULL) {
+        root = dwrxOrderNewNode(0);
+        root->count = 2;
+        root->child[0] = o->root;
+        root->child[1] = split;
+        root->key[1] = split->key[0];
+        o->root = root;
+    }
+}
+
+static void dwrxOrderDelete(dwrxOrder *o, const char *name) {
+    dwrxOrderNode *n = o->root;
+
+    if (n == NULL || !dwrxOrderRemove(n, name)) return;
+    // a root with one child hands over to it
+    if (!n->leaf && n->count == 1) {
+        o->root = n->child[0];
+        free(n);
+    }
+}
+
+static void dwrxOrderFreeNode(dwrxOrderNode *n) {
+    if (!n->leaf) {
+        for (int i = 0; i < n->count; i++) dwrxOrderFreeNode(n->child[i]);
+    }
+    free(n);
+}
+
+// the leaf and slot of the first name at or after from
+static dwrxOrderNode *dwrxOrderSeek(dwrxOrder *o, const char *from, int *at) {
+    dwrxOrderNode *n = o->root;
+
+    if (n == NULL) return NULL;
+    while (!n->leaf) n = n->child[dwrxOrderChildAt(n, from)];
+    *at = dwrxOrderLeafAt(n, from);
+    return n;
+}
+
 // *****************************************************************************
 // start and stop routine
 
@@ -430,25 +1141,491 @@ void dwrxStart() {
 
 void dwrxStop() {
     FreeImage_DeInitialise();
+    dwrxFreeNames();
 }
 
 // *****************************************************************************
 //
 
+// a data table is the hash for lookups, the slabs its infos live in and the
+// ordered index for walking names in order
+typedef struct {
+	oa_hash *hash;
+	dwrxInfoHeap heap;
+	dwrxOrder order;
+} dwrxTable;
+
 void *dwrxNewTable(wrxState *p) {
-	oa_hash *ret = oa_hash_new(oa_key_ops_string, oa_val_ops_data, oa_hash_lp_idx);
-	ret->val_ops.arg = ret->key_ops.arg = p;
-	return ret;
+	dwrxTable *t = (dwrxTable*)calloc(1, sizeof(dwrxTable));
+
+	if (t == NULL) {
+		wrxError(p, "dwrxNewTable() out of memory");
+		return NULL;
+	}
+	t->heap.p = p;
+	t->hash = oa_hash_new(oa_key_ops_name, oa_val_ops_data);
+	t->hash->key_ops.arg = p;
+	t->hash->val_ops.arg = &t->heap;
+	return t;
+}
+
+// the infos are cleared as the pairs go, then their slabs go all at once
+void dwrxFreeTable(void *table) {
+	dwrxTable *t = (dwrxTable*)table;
+	dwrxInfoSlab *k;
+
+	if (t == NULL) return;
+	oa_hash_free(t->hash);
+	if (t->order.root != NULL) dwrxOrderFreeNode(t->order.root);
+	while ((k = t->heap.slabs) != NULL) {
+		t->heap.slabs = k->next;
+		free(k);
+	}
+	free(t);
+}
+
+// the info stored under name, or NULL. the table keeps it, don't free it
+wrxInfo *dwrxTableGet(void *table, const char *name) {
+	// a name nobody interned can't be a key
+	if ((name = dwrxInterned(name)) == NULL) return NULL;
+	return (wrxInfo*)oa_hash_get(((dwrxTable*)table)->hash, name);
+}
+
+// store a copy of v under name, replacing what was there
+void dwrxTablePut(void *table, const char *name, const wrxInfo *v) {
+	dwrxTable *t = (dwrxTable*)table;
+	wrxInfo *stored;
+
+	if ((name = dwrxIntern(name)) == NULL) return;
+	oa_hash_put(t->hash, name, v);
+	// a replaced value may have landed in another slot, so the index always hears of it.
+	// the old value is freed before the copy, so when that fails the pair holds NULL
+	// and the name goes from both rather than leave the index pointing at freed memory
+	if ((stored = (wrxInfo*)oa_hash_get(t->hash, name)) != NULL) {
+		dwrxOrderPut(&t->order, name, stored);
+	} else {
+		oa_hash_delete(t->hash, name);
+		dwrxOrderDelete(&t->order, name);
+	}
+	dwrxNameRelease(name);
+}
+
+void dwrxTableDelete(void *table, const char *name) {
+	dwrxTable *t = (dwrxTable*)table;
+
+	if ((name = dwrxInterned(name)) == NULL) return;
+	oa_hash_delete(t->hash, name);
+	dwrxOrderDelete(&t->order, name);
+}
+
+// walk the names from from in order, until one isn't under the first
+// prefix bytes of from when prefix isn't 0, or is at or after to when to
+// isn't NULL. func can't change the table
+static int dwrxTableWalk(dwrxTable *t, const char *from, size_t prefix, const char *to, dwrxTableFunc func, void *arg) {
+	dwrxOrderNode *n;
+	int i, ret;
+
+	n = dwrxOrderSeek(&t->order, from, &i);
+	for (; n != NULL; n = n->next, i = 0) {
+		for (; i < n->count; i++) {
+			if (prefix != 0 && strncmp(n->key[i], from, prefix) != 0) return 0;
+			if (to != NULL && strcmp(n->key[i], to) >= 0) return 0;
+			if ((ret = func(n->key[i], n->val[i], arg)) != 0) return ret;
+		}
+	}
+	return 0;
+}
+
+// call func(name, v, arg) for every name starting with prefix, in order. a
+// non zero return from func stops the walk and is returned
+int dwrxTablePrefix(void *table, const char *prefix, dwrxTableFunc func, void *arg) {
+	return dwrxTableWalk((dwrxTable*)table, prefix, strlen(prefix), NULL, func, arg);
+}
+
+// the same for every name from from up to but not including to, NULL for
+// either runs from the start or to the end
+int dwrxTableRange(void *table, const char *from, const char *to, dwrxTableFunc func, void *arg) {
+	return dwrxTableWalk((dwrxTable*)table, (from != NULL) ? from : "", 0, to, func, arg);
+}
+
+// *****************************************************************************
+// a data table any thread can use. names hash to one of DWRX_SHARED_SHARDS
+// shards, each a data table behind its own lock for the writers. readers
+// take no lock at all: each shard also publishes a read index of name to
+// info that is only ever added to, so a probe never sees a half written
+// slot. an info that is replaced or deleted, and a read index that fills up
+// and is swapped for a bigger one, wait for every thread's epoch pin to pass
+// before they are freed, the same way share snapshots are
+#define DWRX_SHARED_SHARDS  16
+#define DWRX_SHARED_SHARD(h) ((h) >> 28)
+
+typedef struct {
+    const char *key;            // NULL for an empty slot, set once
+    wrxInfo *v;                 // NULL once deleted
+} dwrxReadSlot;
+
+typedef struct dwrxReadIndex {
+    struct dwrxReadIndex *next; // on the retired list
+    unsigned long long retired;
+    size_t capacity;            // a power of 2, kept at most half used
+    size_t used;
+    dwrxReadSlot slot[];
+} dwrxReadIndex;
+
+typedef struct {
+    pthread_mutex_t lock;
+    dwrxTable *table;           // the writers' side
+    dwrxReadIndex *read;        // the readers' side
+    dwrxReadIndex *retired;
+    dwrxInfoLimbo limbo;
+    char pad[64];               // keep the shard locks off each other's cache lines
+} dwrxSharedShard;
+
+typedef struct {
+    wrxState *p;
+    dwrxSharedShard shard[DWRX_SHARED_SHARDS];
+} dwrxSharedTable;
+
+void *dwrxNewSharedTable(wrxState *p) {
+    dwrxSharedTable *st = (dwrxSharedTable*)calloc(1, sizeof(dwrxSharedTable));
+
+    if (st == NULL) {
+        wrxError(p, "dwrxNewSharedTable() out of memory");
+        return NULL;
+    }
+    st->p = p;
+    for (int i = 0; i < DWRX_SHARED_SHARDS; i++) {
+        st->shard[i].table = (dwrxTable*)dwrxNewTable(p);
+        if (st->shard[i].table == NULL) {
+            dwrxFreeSharedTable(st);
+            return NULL;
+        }
+        st->shard[i].table->heap.limbo = &st->shard[i].limbo;
+        pthread_mutex_init(&st->shard[i].lock, NULL);
+    }
+    return st;
+}
+
+// a read index holds its keys, even the deleted ones a probe still walks past
+static void dwrxReadFree(dwrxReadIndex *x) {
+    if (x == NULL) return;
+    for (size_t i = 0; i < x->capacity; i++) {
+        if (x->slot[i].key != NULL) dwrxNameRelease(x->slot[i].key);
+    }
+    free(x);
+}
+
+// the infos and read indexes let go of before oldest, every one when oldest is 0
+static void dwrxSharedFreeRetired(dwrxSharedShard *s, unsigned long long oldest) {
+    dwrxInfoLimbo *l = &s->limbo;
+    dwrxReadIndex **x, *gone;
+    size_t i, kept = 0;
+
+    for (i = 0; i < l->count; i++) {
+        if (oldest == 0 || l->entry[i].retired < oldest) {
+            dwrxClearInfo(l->entry[i].v);
+            dwrxInfoRelease(&s->table->heap, l->entry[i].v);
+        } else l->entry[kept++] = l->entry[i];
+    }
+    l->count = kept;
+    for (x = &s->retired; *x != NULL; ) {
+        if (oldest == 0 || (*x)->retired < oldest) {
+            gone = *x;
+            *x = gone->next;
+            dwrxReadFree(gone);
+        } else x = &(*x)->next;
+    }
+}
+
+// no thread can be reading it anymore
+void dwrxFreeSharedTable(void *table) {
+    dwrxSharedTable *st = (dwrxSharedTable*)table;
+    dwrxSharedShard *s;
+
+    if (st == NULL) return;
+    for (int i = 0; i < DWRX_SHARED_SHARDS; i++) {
+        s = &st->shard[i];
+        if (s->table == NULL) continue;
+        dwrxSharedFreeRetired(s, 0);
+        s->table->heap.limbo = NULL;
+        dwrxFreeTable(s->table);
+        free(s->limbo.entry);
+        dwrxReadFree(s->read);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(st);
+}
+
+// on the main thread once pins have moved on, see wrxPublishShares()
+void dwrxReclaimSharedTable(void *table, unsigned long long oldest) {
+    dwrxSharedTable *st = (dwrxSharedTable*)table;
+    dwrxSharedShard *s;
+
+    for (int i = 0; i < DWRX_SHARED_SHARDS; i++) {
+        s = &st->shard[i];
+        pthread_mutex_lock(&s->lock);
+        if (s->limbo.count != 0 || s->retired != NULL) dwrxSharedFreeRetired(s, oldest);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static dwrxReadSlot *dwrxReadFind(dwrxReadIndex *x, const char *name, unsigned int hash) {
+    size_t mask = x->capacity - 1;
+    dwrxReadSlot *e;
+    const char *k;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        e = &x->slot[i];
+        k = xatomic_load(&e->key);
+        if (k == NULL || k == name) return e;
+    }
+}
+
+// point name at v in the shard's read index, under the shard lock
+static int dwrxReadSet(dwrxSharedTable *st, dwrxSharedShard *s, const char *name, unsigned int hash, wrxInfo *v) {
+    dwrxReadIndex *x = s->read, *nx;
+    dwrxReadSlot *e = NULL;
+    size_t live = 1, capacity = 16;
+
+    if (x != NULL) {
+        e = dwrxReadFind(x, name, hash);
+        if (e->key == name) {
+            xatomic_store(&e->v, v);
+            return WRX_OK;
+        }
+    }
+    if (v == NULL) return WRX_OK;
+    if (x == NULL || (x->used + 1) * 2 > x->capacity) {
+        // full, build a new one with only the live names and room to grow
+        for (size_t i = 0; x != NULL && i < x->capacity; i++) {
+            if (x->slot[i].v != NULL) live++;
+        }
+        while (capacity < live * 4) capacity *= 2;
+        nx = (dwrxReadIndex*)calloc(1, sizeof(dwrxReadIndex) + capacity * sizeof(dwrxReadSlot));
+        if (nx == NULL) return WRX_NOPE;
+        nx->capacity = capacity;
+        for (size_t i = 0; x != NULL && i < x->capacity; i++) {
+            if (x->slot[i].v == NULL) continue;
+            e = dwrxReadFind(nx, x->slot[i].key, dwrxNameHash(x->slot[i].key));
+            *e = x->slot[i];
+            dwrxNameRetain(e->key);
+            nx->used++;
+        }
+        xatomic_store(&s->read, nx);
+        if (x != NULL) {
+            x->retired = xatomic_load(&st->p->epoch);
+            x->next = s->retired;
+            s->retired = x;
+        }
+        x = nx;
+        e = dwrxReadFind(x, name, hash);
+    }
+    // the info before the key, a reader that finds the key finds it whole
+    e->v = v;
+    dwrxNameRetain(name);
+    xatomic_store(&e->key, name);
+    x->used++;
+    return WRX_OK;
+}
+
+// the info under name, or NULL. it stays good until the thread calls
+// wrxSnapshotRelease(), t is NULL on the main thread. never blocks
+const wrxInfo *dwrxSharedGet(void *table, wrxThread *t, const char *name) {
+    dwrxSharedTable *st = (dwrxSharedTable*)table;
+    dwrxReadIndex *x;
+    unsigned int hash;
+
+    // pinned first, so the name can't be reclaimed under us
+    wrxEpochPin(st->p, t);
+    if ((name = dwrxInterned(name)) == NULL) return NULL;
+    hash = dwrxNameHash(name);
+    x = xatomic_load(&st->shard[DWRX_SHARED_SHARD(hash)].read);
+    if (x == NULL) return NULL;
+    return xatomic_load(&dwrxReadFind(x, name, hash)->v);
+}
+
+// store a copy of v under name, replacing what was there
+int dwrxSharedPut(void *table, const char *name, const wrxInfo *v) {
+    dwrxSharedTable *st = (dwrxSharedTable*)table;
+    dwrxSharedShard *s;
+    unsigned int hash;
+    wrxInfo *stored;
+    int ret = WRX_NOPE;
+
+    if ((name = dwrxIntern(name)) == NULL) return WRX_NOPE;
+    hash = dwrxNameHash(name);
+    s = &st->shard[DWRX_SHARED_SHARD(hash)];
+    pthread_mutex_lock(&s->lock);
+    dwrxTablePut(s->table, name, v);
+    // NULL when the copy failed, readers mustn't keep the old one either
+    stored = (wrxInfo*)oa_hash_get(s->table->hash, name);
+    ret = dwrxReadSet(st, s, name, hash, stored);
+    if (stored == NULL) ret = WRX_NOPE;
+    pthread_mutex_unlock(&s->lock);
+    dwrxNameRelease(name);
+    return ret;
+}
+
+void dwrxSharedDelete(void *table, const char *name) {
+    dwrxSharedTable *st = (dwrxSharedTable*)table;
+    dwrxSharedShard *s;
+    unsigned int hash;
+
+    if ((name = dwrxInterned(name)) == NULL) return;
+    hash = dwrxNameHash(name);
+    s = &st->shard[DWRX_SHARED_SHARD(hash)];
+    pthread_mutex_lock(&s->lock);
+    dwrxReadSet(st, s, name, hash, NULL);
+    dwrxTableDelete(s->table, name);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// walk the names in order across every shard, merging their ordered indexes.
+// the shards stay locked for the walk, so func can read but not write it
+static int dwrxSharedWalk(dwrxSharedTable *st, const char *from, size_t prefix, const char *to, dwrxTableFunc func, void *arg) {
+    dwrxOrderNode *n[DWRX_SHARED_SHARDS];
+    int at[DWRX_SHARED_SHARDS], i, best, ret = 0;
+    const char *name;
+
+    for (i = 0; i < DWRX_SHARED_SHARDS; i++) {
+        pthread_mutex_lock(&st->shard[i].lock);
+        n[i] = dwrxOrderSeek(&st->shard[i].table->order, from, &at[i]);
+    }
+    for (;;) {
+        best = -1;
+        for (i = 0; i < DWRX_SHARED_SHARDS; i++) {
+            while (n[i] != NULL && at[i] >= n[i]->count) {
+                n[i] = n[i]->next;
+                at[i] = 0;
+            }
+            if (n[i] != NULL && (best < 0 || strcmp(n[i]->key[at[i]], n[best]->key[at[best]]) < 0)) best = i;
+        }
+        if (best < 0) break;
+        name = n[best]->key[at[best]];
+        if (prefix != 0 && strncmp(name, from, prefix) != 0) break;
+        if (to != NULL && strcmp(name, to) >= 0) break;
+        if ((ret = func(name, n[best]->val[at[best]], arg)) != 0) break;
+        at[best]++;
+    }
+    for (i = DWRX_SHARED_SHARDS - 1; i >= 0; i--) pthread_mutex_unlock(&st->shard[i].lock);
+    return ret;
+}
+
+int dwrxSharedPrefix(void *table, const char *prefix, dwrxTableFunc func, void *arg) {
+    return dwrxSharedWalk((dwrxSharedTable*)table, prefix, strlen(prefix), NULL, func, arg);
 }
 
+int dwrxSharedRange(void *table, const char *from, const char *to, dwrxTableFunc func, void *arg) {
+    return dwrxSharedWalk((dwrxSharedTable*)table, (from != NULL) ? from : "", 0, to, func, arg);
+}
+
+// *****************************************************************************
+// id trees, a slot map over a 16 way radix tree. a slot's number is the low
+// idBits of an id and the tree takes 4 bits of it a level from the top, the
+// bottom level holds the slots themselves, so every lookup takes exactly
+// idBits / 4 steps. levels are only made when a slot under them is.
+// a freed slot goes on the back of a free list and is used again from the
+// front, and each time it is freed its generation goes up. the generation
+// rides in the id bits above idBits, 8 of them at 16 and 4 at 20, so an id
+// kept past its info no longer matches. at 24 there are none left and a
+// stale id is only caught until its slot is used again
+
 void *dwrxNewTree(wrxState *p, int id_bits) {
 	wrxIdTree *ret = (wrxIdTree*)calloc(sizeof(wrxIdTree), 1);
+	if (ret == NULL) {
+		wrxError(p, "dwrxNewTree() out of memory");
+		return NULL;
+	}
 	ret->idBits = id_bits;
+	// slot 0 is never used, so no id is 0
+	ret->next = 1;
 	return ret;
 }
 
+static void dwrxFreeTreeLevel(void *l, int depth) {
+	wrxIdTreeNode *n = (wrxIdTreeNode*)l;
+
+	for (int i = 0; i < 16; i++) {
+		if (depth > 0) {
+			if (((wrxIdTreeLevel*)l)->child[i] != NULL) dwrxFreeTreeLevel(((wrxIdTreeLevel*)l)->child[i], depth - 1);
+		} else if (n[i].data != NULL) dwrxFreeInfo(n[i].data);
+	}
+	free(l);
+}
+
+// the tree, its levels and every info still in it
 void dwrxFreeTree(wrxIdTree *tree) {
+	if (tree == NULL) return;
+	if (tree->root != NULL) dwrxFreeTreeLevel(tree->root, tree->idBits / 4 - 1);
+	free(tree);
+}
+
+// the slot numbered index, making the levels down to it when make is set
+static wrxIdTreeNode *dwrxTreeNode(wrxIdTree *tree, unsigned int index, int make) {
+	void **l = (void**)&tree->root;
+
+	for (int shift = tree->idBits - 4; shift > 0; shift -= 4) {
+		if (*l == NULL && (!make || (*l = calloc(1, sizeof(wrxIdTreeLevel))) == NULL)) return NULL;
+		l = &((wrxIdTreeLevel*)*l)->child[(index >> shift) & 15];
+	}
+	if (*l == NULL && (!make || (*l = calloc(16, sizeof(wrxIdTreeNode))) == NULL)) return NULL;
+	return &((wrxIdTreeNode*)*l)[index & 15];
+}
+
+// the id of a slot as of its generation
+static unsigned int dwrxTreeId(wrxIdTree *tree, unsigned int index, unsigned int generation) {
+	return ((generation & ((1u << (24 - tree->idBits)) - 1)) << tree->idBits) | index;
+}
+
+// the slot id names, or NULL when it is stale or was never handed out
+static wrxIdTreeNode *dwrxTreeFind(wrxIdTree *tree, unsigned int id) {
+	unsigned int index = id & ((1u << tree->idBits) - 1);
+	wrxIdTreeNode *n = dwrxTreeNode(tree, index, 0);
+
+	if (n == NULL || n->data == NULL || dwrxTreeId(tree, index, n->generation) != id) return NULL;
+	return n;
+}
+
+// the info under id, or NULL
+wrxInfo *dwrxTreeGet(wrxIdTree *tree, unsigned int id) {
+	wrxIdTreeNode *n = dwrxTreeFind(tree, id);
+	return (n != NULL) ? n->data : NULL;
+}
+
+// put v in a slot and return its id, 0 when every slot is in use
+unsigned int dwrxTreeAdd(wrxIdTree *tree, wrxInfo *v) {
+	unsigned int index = tree->freeHead;
+	wrxIdTreeNode *n;
+
+	if (index != 0) {
+		n = dwrxTreeNode(tree, index, 0);
+		tree->freeHead = n->next;
+		if (tree->freeHead == 0) tree->freeTail = 0;
+	} else {
+		if (tree->next >> tree->idBits) return 0;
+		if ((n = dwrxTreeNode(tree, tree->next, 1)) == NULL) return 0;
+		index = tree->next++;
+	}
+	n->data = v;
+	n->next = 0;
+	return dwrxTreeId(tree, index, n->generation);
+}
 
+// take id out of the tree and hand back its info, NULL when it is stale
+wrxInfo *dwrxTreeRemove(wrxIdTree *tree, unsigned int id) {
+	wrxIdTreeNode *n = dwrxTreeFind(tree, id);
+	unsigned int index = id & ((1u << tree->idBits) - 1);
+	wrxInfo *ret;
+
+	if (n == NULL) return NULL;
+	ret = n->data;
+	n->data = NULL;
+	n->generation++;
+	// on the back, so a slot is used again as late as it can be
+	if (tree->freeTail != 0) dwrxTreeNode(tree, tree->freeTail, 0)->next = index;
+		else tree->freeHead = index;
+	tree->freeTail = index;
+	return ret;
 }
 
 wrxInfo *dwrxReadFile(const char* fname) {
@@ -479,18 +1656,50 @@ wrxInfo *dwrxReadFile(const char* fname) {
 }
 
 void dwrxFreeInfo(wrxInfo *p) {
+    dwrxClearInfo(p);
+	free(p);
+}
+
+// release anything the info owns, but not the info itself
+void dwrxClearInfo(wrxInfo *p) {
     switch (p->form) {
         case WRX_FORM_DATA:
+        case WRX_FORM_TABLE:
                 free(p->data.memory);
             break;
         case WRX_FORM_MEMIO:
                 free(p->io.mem);
             break;
-        case WRX_FORM_TABLE:
-            // TODO
+        case WRX_FORM_BLOB:
+                dwrxReleaseBlob((wrxBlob*)p->p);
+            break;
+        case WRX_FORM_CHANNEL:
+                wrxReleaseChannel((wrxChannel*)p->p);
             break;
     }
-	free(p);
+    p->form = WRX_FORM_NULL;
+}
+
+// a blob holding a copy of mem, or zeroed when mem is NULL, with one reference
+wrxBlob *dwrxNewBlob(const void *mem, unsigned int length) {
+    wrxBlob *ret = (wrxBlob*)malloc(sizeof(wrxBlob) + length + 1);
+
+    if (ret == NULL) return NULL;
+    ret->refs = 1;
+    ret->length = length;
+    if (mem != NULL) memcpy(ret->mem, mem, length);
+        else memset(ret->mem, 0, length);
+    // null terminate in case we need that, like dwrxReadFile()
+    ret->mem[length] = 0;
+    return ret;
+}
+
+void dwrxRetainBlob(wrxBlob *b) {
+    xatomic_add(&b->refs, 1);
+}
+
+void dwrxReleaseBlob(wrxBlob *b) {
+    if (b != NULL && xatomic_sub(&b->refs, 1) == 0) free(b);
 }
 
 //  --------------------------------------------------------------------------
@@ -0,0 +1,171 @@
+/*
+	wrx-engine: frame graph
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WRX_STAGE_WAIT		0
+#define WRX_STAGE_READY		1			// waiting on the main thread to run it
+#define WRX_STAGE_RUN		2
+#define WRX_STAGE_DONE		3
+
+typedef struct wrxStage {
+	char name[32];
+	wrxStageFunc func;
+	void *arg;
+	int flags;
+	unsigned int after;					// bit i set when this waits on stage i
+	int waiting;						// stages left to finish this frame before it runs
+	int state;
+	struct wrxFrame *frame;
+} wrxStage;
+
+typedef struct wrxFrame {
+	int count;
+	int left;							// stages not yet finished this frame
+	int wake;							// set when a main stage is ready or the frame is done
+	wrxState *state;
+	wrxStage stage[WRX_MAX_STAGES];
+} wrxFrame;
+
+static void wrxStageDispatch(wrxFrame *f, wrxStage *s);
+
+static int wrxStageFind(wrxFrame *f, const char *name) {
+	for (int i = 0; f != NULL && i < f->count; i++) {
+		if (!strcmp(f->stage[i].name, name)) return i;
+	}
+	return -1;
+}
+
+// a stage's flags, or -1 when there is no such stage
+int wrxStageFlags(wrxState *p, const char *name) {
+	int i = wrxStageFind(p->frame, name);
+
+	return (i < 0) ? -1 : ((wrxFrame*)p->frame)->stage[i].flags;
+}
+
+// mark s done, then start anything that was only waiting on it
+static void wrxStageFinish(wrxFrame *f, wrxStage *s) {
+	unsigned int bit = 1u << (s - f->stage);
+	int wake = 0;
+
+	xatomic_store(&s->state, WRX_STAGE_DONE);
+	for (int i = 0; i < f->count; i++) {
+		if ((f->stage[i].after & bit) && xatomic_sub(&f->stage[i].waiting, 1) == 0) {
+			wrxStageDispatch(f, &f->stage[i]);
+			if (xatomic_load(&f->stage[i].state) == WRX_STAGE_READY) wake = 1;
+		}
+	}
+	if (xatomic_sub(&f->left, 1) == 0) wake = 1;
+	if (wake) wrxJobDone(f->state, &f->wake, 1);
+}
+
+static void wrxStageRun(wrxThread *t, void *arg) {
+	wrxStage *s = arg;
+
+	s->func(s->frame->state, t, s->arg);
+	wrxStageFinish(s->frame, s);
+}
+
+// worker stages go to the compute pool, main stages and anything the pool
+// won't take are left for the main thread
+static void wrxStageDispatch(wrxFrame *f, wrxStage *s) {
+	if (!(s->flags & WRX_STAGE_MAIN)) {
+		xatomic_store(&s->state, WRX_STAGE_RUN);
+		if (wrxJobSubmit(f->state, wrxStageRun, s) == WRX_OK) return;
+	}
+	xatomic_store(&s->state, WRX_STAGE_READY);
+}
+
+// add a stage to every frame, it runs after the stages named with
+// wrxStageAfter(). a WRX_STAGE_FINAL stage runs after all the others
+int wrxAddStage(wrxState *p, const char *name, wrxStageFunc func, void *arg, int flags) {
+	wrxFrame *f = p->frame;
+	wrxStage *s;
+
+	if (f == NULL) {
+		f = calloc(1, sizeof(wrxFrame));
+		if (f == NULL) return wrxError(p, "wrxAddStage() out of memory");
+		f->state = p;
+		p->frame = f;
+	}
+	if (wrxStageFind(f, name) >= 0) return wrxError(p, "wrxAddStage() there is already a stage named %s", name);
+	if (f->count >= WRX_MAX_STAGES) return wrxError(p, "wrxAddStage() too many stages");
+
+	s = &f->stage[f->count];
+	strncpy(s->name, name, sizeof(s->name) - 1);
+	s->func = func;
+	s->arg = arg;
+	s->flags = flags;
+	s->frame = f;
+	f->count++;
+	return WRX_OK;
+}
+
+// make stage name wait on stage after, which must have been added first so the
+// graph can't loop
+int wrxStageAfter(wrxState *p, const char *name, const char *after) {
+	wrxFrame *f = p->frame;
+	int s, a;
+
+	if (f == NULL || (s = wrxStageFind(f, name)) < 0) return wrxError(p, "wrxStageAfter() no stage named %s", name);
+	if ((a = wrxStageFind(f, after)) < 0) return wrxError(p, "wrxStageAfter() no stage named %s", after);
+	if (a >= s) return wrxError(p, "wrxStageAfter() %s must be added before %s", after, name);
+	if (f->stage[a].flags & WRX_STAGE_FINAL) return wrxError(p, "wrxStageAfter() nothing can follow %s", after);
+	f->stage[s].after |= 1u << a;
+	return WRX_OK;
+}
+
+// run one frame's stages, returning once they are all done. worker stages
+// overlap each other and the main stages wherever the graph allows
+int wrxRunFrame(wrxState *p) {
+	wrxFrame *f = p->frame;
+	wrxStage *s;
+	unsigned int others = 0, roots = 0;
+	int i, ran, e;
+
+	if (f == NULL || f->count == 0) return WRX_OK;
+	for (i = 0; i < f->count; i++) {
+		if (!(f->stage[i].flags & WRX_STAGE_FINAL)) others |= 1u << i;
+	}
+	for (i = 0; i < f->count; i++) {
+		s = &f->stage[i];
+		if (s->flags & WRX_STAGE_FINAL) s->after = others;
+		s->waiting = __builtin_popcount(s->after);
+		s->state = WRX_STAGE_WAIT;
+		if (s->waiting == 0) roots |= 1u << i;
+	}
+	// pick the roots before starting any, a finished root dispatches the rest
+	xatomic_store(&f->left, f->count);
+	for (i = 0; i < f->count; i++) {
+		if (roots & (1u << i)) wrxStageDispatch(f, &f->stage[i]);
+	}
+
+	while (xatomic_load(&f->left) > 0) {
+		// clear wake before looking, a stage that becomes ready after we look sets it again
+		xatomic_store(&f->wake, 0);
+		ran = 0;
+		for (i = 0; i < f->count; i++) {
+			s = &f->stage[i];
+			e = WRX_STAGE_READY;
+			if (xatomic_load(&s->state) == WRX_STAGE_READY && xatomic_cas(&s->state, &e, WRX_STAGE_RUN)) {
+				s->func(p, NULL, s->arg);
+				wrxStageFinish(f, s);
+				ran = 1;
+			}
+		}
+		if (!ran && xatomic_load(&f->left) > 0) wrxJobWait(p, &f->wake);
+	}
+	return WRX_OK;
+}
+
+void wrxFreeFrame(wrxState *p) {
+	free(p->frame);
+	p->frame = NULL;
+}
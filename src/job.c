@@ -0,0 +1,573 @@
+/*
+	wrx-engine: job system
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+// the thread function
+xthread_ret wrxThreadRoutine(void *p);
+int wrxThreadIsOk(wrxThread *p);
+
+#define WRX_DEQUE_SIZE		4096		// jobs per worker deque, must be a power of 2
+#define WRX_DEQUE_MASK		(WRX_DEQUE_SIZE - 1)
+#define WRX_MAX_KERNELS		64			// named C kernels for wrx.parallel_for()
+
+typedef struct wrxJob {
+	wrxJobFunc func;
+	void *arg;
+	struct wrxJob *next;				// only used on the inject queue
+} wrxJob;
+
+// Chase-Lev work stealing deque: the owning worker pushes and takes at the
+// bottom, any other worker steals from the top
+typedef struct {
+	long long top;
+	char pad[64 - sizeof(long long)];	// keep top and bottom on their own cache lines
+	long long bottom;
+	wrxJob *ring[WRX_DEQUE_SIZE];
+} wrxDeque;
+
+// a set of workers sharing an inject queue, they only steal from each other
+typedef struct {
+	int running;
+	int sleeping;						// workers parked on wake
+	int queued;							// jobs submitted but not yet taken
+	int first;							// the pool's workers are p->thread[first .. first + count - 1]
+	int count;
+	pthread_mutex_t lock;				// guards the inject queue and parking
+	pthread_cond_t wake;
+	wrxJob *head;						// jobs submitted from outside the pool
+	wrxJob *tail;
+	char pad[64];						// keep the pools off each other's cache lines
+} wrxPool;
+
+typedef struct {
+	wrxPool pool[WRX_POOLS];
+	int waiters;						// threads blocked in wrxJobWait()
+	pthread_mutex_t lock;				// guards done
+	pthread_cond_t done;
+} wrxJobs;
+
+// the worker running on this thread, NULL on any other thread
+static xthread_local wrxThread *wrxJobCurrent = NULL;
+
+// *****************************************************************************
+// deque
+static int wrxDequePush(wrxDeque *d, wrxJob *j) {
+	long long b = xatomic_load_relaxed(&d->bottom);
+	long long t = xatomic_load(&d->top);
+
+	if (b - t > WRX_DEQUE_MASK) return WRX_NOPE;
+	xatomic_store_relaxed(&d->ring[b & WRX_DEQUE_MASK], j);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	xatomic_store_relaxed(&d->bottom, b + 1);
+	return WRX_OK;
+}
+
+static wrxJob *wrxDequeTake(wrxDeque *d) {
+	long long b = xatomic_load_relaxed(&d->bottom) - 1;
+	long long t;
+	wrxJob *j = NULL;
+
+	xatomic_store_relaxed(&d->bottom, b);
+	xatomic_fence();
+	t = xatomic_load_relaxed(&d->top);
+	if (t <= b) {
+		j = xatomic_load_relaxed(&d->ring[b & WRX_DEQUE_MASK]);
+		if (t == b) {
+			// last job, so race any thieves for it
+			if (!xatomic_cas(&d->top, &t, t + 1)) j = NULL;
+			xatomic_store_relaxed(&d->bottom, b + 1);
+		}
+	} else {
+		xatomic_store_relaxed(&d->bottom, b + 1);
+	}
+	return j;
+}
+
+static wrxJob *wrxDequeSteal(wrxDeque *d) {
+	long long t = xatomic_load(&d->top);
+	long long b;
+	wrxJob *j;
+
+	xatomic_fence();
+	b = xatomic_load(&d->bottom);
+	if (t >= b) return NULL;
+	j = xatomic_load_relaxed(&d->ring[t & WRX_DEQUE_MASK]);
+	if (!xatomic_cas(&d->top, &t, t + 1)) return NULL;
+	return j;
+}
+
+// *****************************************************************************
+// pools
+static wrxJob *wrxJobInjected(wrxPool *pl) {
+	wrxJob *j;
+
+	if (xatomic_load(&pl->head) == NULL) return NULL;
+	pthread_mutex_lock(&pl->lock);
+	j = pl->head;
+	if (j != NULL) {
+		pl->head = j->next;
+		if (pl->head == NULL) pl->tail = NULL;
+	}
+	pthread_mutex_unlock(&pl->lock);
+	return j;
+}
+
+// own deque first, then the inject queue, then steal from the rest of the pool
+static wrxJob *wrxJobFind(wrxState *p, wrxPool *pl, wrxThread *t) {
+	wrxJob *j = NULL;
+	int i, n;
+
+	if (t != NULL) j = wrxDequeTake(t->queue);
+	if (j == NULL) j = wrxJobInjected(pl);
+	for (i = 0; j == NULL && i < pl->count; i++) {
+		n = (t == NULL) ? i : (t->id - pl->first + 1 + i) % pl->count;
+		if (p->thread[pl->first + n] != t) j = wrxDequeSteal(p->thread[pl->first + n]->queue);
+	}
+	if (j != NULL) xatomic_sub(&pl->queued, 1);
+	return j;
+}
+
+static void wrxJobRun(wrxThread *t, wrxJob *j) {
+	j->func(t, j->arg);
+	free(j);
+}
+
+// fill in pool sizes left at 0 from the core count. the main thread keeps a
+// core to itself, io workers spend most of their time blocked so a couple do
+static void wrxJobSize(wrxState *p) {
+	int procs = pcthread_get_num_procs();
+
+	if (procs < 1) procs = 1;
+	if (p->threads <= 0) p->threads = (procs > 1) ? procs - 1 : 1;
+	if (p->ioThreads <= 0) p->ioThreads = (procs >= 8) ? 2 : 1;
+	if (p->ioThreads > WRX_MAX_THREADS / 4) p->ioThreads = WRX_MAX_THREADS / 4;
+	if (p->threads + p->ioThreads > WRX_MAX_THREADS) p->threads = WRX_MAX_THREADS - p->ioThreads;
+}
+
+int wrxJobStart(wrxState *p) {
+	wrxJobs *js = calloc(1, sizeof(wrxJobs));
+	int i, procs, total;
+
+	if (js == NULL) return wrxError(p, "wrxJobStart() out of memory");
+	wrxJobSize(p);
+	total = p->threads + p->ioThreads;
+	js->pool[WRX_POOL_COMPUTE].first = 0;
+	js->pool[WRX_POOL_COMPUTE].count = p->threads;
+	js->pool[WRX_POOL_IO].first = p->threads;
+	js->pool[WRX_POOL_IO].count = p->ioThreads;
+	for (i = 0; i < WRX_POOLS; i++) {
+		js->pool[i].running = 1;
+		pthread_mutex_init(&js->pool[i].lock, NULL);
+		pthread_cond_init(&js->pool[i].wake, NULL);
+	}
+	pthread_mutex_init(&js->lock, NULL);
+	pthread_cond_init(&js->done, NULL);
+	p->jobs = js;
+
+	// create the threads, compute workers first
+	for (i = 0; i < total; i++) {
+		wrxThread *pt = calloc(1, sizeof(wrxThread));
+		pt->id = i;
+		pt->pool = (i < p->threads) ? WRX_POOL_COMPUTE : WRX_POOL_IO;
+		pt->mode = WRX_OK;
+		pt->state = p;
+		pt->sleepUMS = 5000;
+		pt->queue = calloc(1, sizeof(wrxDeque));
+		pthread_mutex_init(&pt->stateLock, NULL);
+		pt->inbox = wrxNewInbox();
+		p->thread[i] = pt;
+	}
+	// only start them once every deque exists, they steal from each other
+	procs = pcthread_get_num_procs();
+	for (i = 0; i < total; i++) {
+		xthread_create(&p->thread[i]->handle, wrxThreadRoutine, p->thread[i]);
+		// pin compute workers from core 1 up, leaving core 0 to the main thread,
+		// io workers float since they mostly sleep
+		if (p->pinThreads && procs > 1 && i < p->threads) {
+			if (xthread_pin(p->thread[i]->handle, 1 + i % (procs - 1)) != 0)
+				wrxError(p, "wrxJobStart() could not pin thread %d", i);
+		}
+	}
+
+	return WRX_OK;
+}
+
+// let the workers finish what is queued, then join them
+void wrxJobStop(wrxState *p) {
+	wrxJobs *js = p->jobs;
+	wrxJob *j;
+	int i, total;
+
+	if (js == NULL) return;
+	total = p->threads + p->ioThreads;
+	for (i = 0; i < total; i++) {
+		pthread_mutex_lock(&p->thread[i]->stateLock);
+		p->thread[i]->mode = WRX_STOP;
+		pthread_mutex_unlock(&p->thread[i]->stateLock);
+	}
+	for (i = 0; i < WRX_POOLS; i++) {
+		pthread_mutex_lock(&js->pool[i].lock);
+		js->pool[i].running = 0;
+		pthread_cond_broadcast(&js->pool[i].wake);
+		pthread_mutex_unlock(&js->pool[i].lock);
+	}
+
+	// join them all before freeing anything, the others may still steal
+	for (i = 0; i < total; i++) {
+		xthread_join(p->thread[i]->handle, NULL);
+	}
+	for (i = 0; i < total; i++) {
+		pthread_mutex_destroy(&p->thread[i]->stateLock);
+		wrxFreeInbox(p->thread[i]->inbox);
+		free(p->thread[i]->queue);
+		free(p->thread[i]);
+		p->thread[i] = NULL;
+	}
+	for (i = 0; i < WRX_POOLS; i++) {
+		while ((j = js->pool[i].head) != NULL) {
+			js->pool[i].head = j->next;
+			free(j);
+		}
+		pthread_cond_destroy(&js->pool[i].wake);
+		pthread_mutex_destroy(&js->pool[i].lock);
+	}
+
+	pthread_cond_destroy(&js->done);
+	pthread_mutex_destroy(&js->lock);
+	free(js);
+	p->jobs = NULL;
+}
+
+// queue func(thread, arg) to run on a compute worker
+int wrxJobSubmit(wrxState *p, wrxJobFunc func, void *arg) {
+	return wrxJobSubmitTo(p, WRX_POOL_COMPUTE, func, arg);
+}
+
+// queue func(thread, arg) to run on some worker in pool, a worker submitting to
+// its own pool keeps the job on its deque so related work stays local until
+// someone steals it
+int wrxJobSubmitTo(wrxState *p, int pool, wrxJobFunc func, void *arg) {
+	wrxJobs *js = p->jobs;
+	wrxPool *pl;
+	wrxThread *t = wrxJobCurrent;
+	wrxJob *j;
+
+	if (js == NULL || pool < 0 || pool >= WRX_POOLS) return WRX_ERR;
+	pl = &js->pool[pool];
+	if (!xatomic_load(&pl->running)) return WRX_ERR;
+	j = malloc(sizeof(wrxJob));
+	if (j == NULL) return WRX_ERR;
+	j->func = func;
+	j->arg = arg;
+	j->next = NULL;
+
+	xatomic_add(&pl->queued, 1);
+	if (t == NULL || t->state != p || t->pool != pool || !wrxDequePush(t->queue, j)) {
+		pthread_mutex_lock(&pl->lock);
+		if (pl->tail != NULL) pl->tail->next = j;
+			else pl->head = j;
+		pl->tail = j;
+		pthread_mutex_unlock(&pl->lock);
+	}
+	// pairs with the sleeping/queued check in wrxJobWork()
+	if (xatomic_load(&pl->sleeping) > 0) {
+		pthread_mutex_lock(&pl->lock);
+		pthread_cond_signal(&pl->wake);
+		pthread_mutex_unlock(&pl->lock);
+	}
+	return WRX_OK;
+}
+
+// the worker loop, runs until wrxJobStop()
+void wrxJobWork(wrxThread *t) {
+	wrxState *p = t->state;
+	wrxPool *pl = &((wrxJobs*)p->jobs)->pool[t->pool];
+	wrxJob *j;
+
+	wrxJobCurrent = t;
+	for (;;) {
+		j = wrxJobFind(p, pl, t);
+		if (j != NULL) {
+			// pinned for the whole job, so names and snapshots it finds stay put
+			wrxEpochPin(p, t);
+			wrxJobRun(t, j);
+			// snapshots last for a whole job, including any it ran while waiting
+			wrxSnapshotRelease(p, t);
+			continue;
+		}
+		if (!wrxThreadIsOk(t)) break;
+		// nothing to do, so park until a submit wakes us
+		xatomic_add(&pl->sleeping, 1);
+		pthread_mutex_lock(&pl->lock);
+		while (xatomic_load(&pl->queued) == 0 && pl->running) {
+			pthread_cond_wait(&pl->wake, &pl->lock);
+		}
+		pthread_mutex_unlock(&pl->lock);
+		xatomic_sub(&pl->sleeping, 1);
+	}
+	wrxJobCurrent = NULL;
+}
+
+// set *flag and wake anyone in wrxJobWait() on it
+void wrxJobDone(wrxState *p, int *flag, int value) {
+	wrxJobs *js = p->jobs;
+
+	xatomic_store(flag, value);
+	xatomic_fence();
+	if (xatomic_load(&js->waiters) > 0) {
+		pthread_mutex_lock(&js->lock);
+		pthread_cond_broadcast(&js->done);
+		pthread_mutex_unlock(&js->lock);
+	}
+}
+
+// block until *flag is set by wrxJobDone(), a worker keeps running jobs from its
+// pool while it waits so a pool full of waiting jobs can't deadlock
+void wrxJobWait(wrxState *p, int *flag) {
+	wrxJobs *js = p->jobs;
+	wrxThread *t = wrxJobCurrent;
+	struct timespec ts;
+	wrxJob *j;
+
+	while (xatomic_load(flag) == 0) {
+		if (t != NULL && (j = wrxJobFind(p, &js->pool[t->pool], t)) != NULL) {
+			wrxJobRun(t, j);
+			continue;
+		}
+		xatomic_add(&js->waiters, 1);
+		pthread_mutex_lock(&js->lock);
+		if (xatomic_load(flag) == 0) {
+			if (t != NULL) {
+				// wake now and then to look for new work
+				ms_to_timespec(&ts, 1);
+				pthread_cond_timedwait(&js->done, &js->lock, &ts);
+			} else pthread_cond_wait(&js->done, &js->lock);
+		}
+		pthread_mutex_unlock(&js->lock);
+		xatomic_sub(&js->waiters, 1);
+	}
+}
+
+// *****************************************************************************
+// parallel for, a buffer cut into grain sized ranges that the workers claim
+// until none are left
+typedef struct {
+	wrxRangeFunc func;
+	void *arg;
+	char *mem;
+	unsigned long long length;
+	unsigned long long grain;
+	unsigned long long next;			// start of the next unclaimed range
+	int jobs;							// range jobs yet to finish
+	int done;
+} wrxParallel;
+
+static struct {
+	char name[32];
+	wrxKernelFunc func;
+} wrxKernels[WRX_MAX_KERNELS];
+static int wrxKernelCount = 0;
+
+static void wrxParallelRun(wrxThread *t, void *arg) {
+	wrxParallel *pf = arg;
+	unsigned long long start;
+
+	for (;;) {
+		start = xatomic_add(&pf->next, pf->grain) - pf->grain;
+		if (start >= pf->length) break;
+		pf->func(t, pf->mem + start, start, (pf->length - start < pf->grain) ? pf->length - start : pf->grain, pf->arg);
+	}
+	// the caller's wrxParallel goes away once done is set, so touch nothing after
+	if (xatomic_sub(&pf->jobs, 1) == 0) wrxJobDone(t->state, &pf->done, 1);
+}
+
+// run func over mem in ranges of grain bytes (0 picks a size) on the compute
+// pool, returning once every range is finished
+int wrxParallelFor(wrxState *p, char *mem, unsigned int length, unsigned int grain, wrxRangeFunc func, void *arg) {
+	wrxJobs *js = p->jobs;
+	wrxParallel pf;
+	int i, ranges, jobs;
+
+	if (js == NULL || js->pool[WRX_POOL_COMPUTE].count == 0) return WRX_ERR;
+	if (length == 0) return WRX_OK;
+	// a few ranges per worker evens out ranges that run slow
+	if (grain == 0) grain = 1 + (length - 1) / (js->pool[WRX_POOL_COMPUTE].count * 4);
+	ranges = 1 + (length - 1) / grain;
+	jobs = (ranges < js->pool[WRX_POOL_COMPUTE].count) ? ranges : js->pool[WRX_POOL_COMPUTE].count;
+
+	memset(&pf, 0, sizeof(wrxParallel));
+	pf.func = func;
+	pf.arg = arg;
+	pf.mem = mem;
+	pf.length = length;
+	pf.grain = grain;
+	pf.jobs = jobs;
+	for (i = 0; i < jobs; i++) {
+		if (wrxJobSubmitTo(p, WRX_POOL_COMPUTE, wrxParallelRun, &pf) != WRX_OK) break;
+	}
+	if (i == 0) return WRX_ERR;
+	// the ones that went out claim every range between them
+	if (i < jobs && xatomic_sub(&pf.jobs, jobs - i) == 0) return WRX_OK;
+	wrxJobWait(p, &pf.done);
+	return WRX_OK;
+}
+
+// name a C kernel for wrx.parallel_for(), call this before wrxStart()
+int wrxAddKernel(const char *name, wrxKernelFunc func) {
+	if (wrxKernelCount >= WRX_MAX_KERNELS) return WRX_NOPE;
+	strncpy(wrxKernels[wrxKernelCount].name, name, sizeof(wrxKernels[0].name) - 1);
+	wrxKernels[wrxKernelCount].func = func;
+	wrxKernelCount++;
+	return WRX_OK;
+}
+
+wrxKernelFunc wrxGetKernel(const char *name) {
+	for (int i = 0; i < wrxKernelCount; i++) {
+		if (!strcmp(wrxKernels[i].name, name)) return wrxKernels[i].func;
+	}
+	return NULL;
+}
+
+// *****************************************************************************
+// inboxes, a bounded ring of wrxMessage per thread (after Vyukov's bounded
+// queue): any thread may put, only the owning thread gets
+typedef struct {
+	unsigned int tail;
+	char pad[64 - sizeof(unsigned int)];
+	unsigned int head;
+	char pad2[64 - sizeof(unsigned int)];
+	wrxMessage ring[WRX_INBOX_SIZE];
+} wrxInbox;
+
+void *wrxNewInbox() {
+	wrxInbox *b = calloc(1, sizeof(wrxInbox));
+
+	if (b == NULL) return NULL;
+	for (unsigned int i = 0; i < WRX_INBOX_SIZE; i++) b->ring[i].seq = i;
+	return b;
+}
+
+// free the inbox and any messages still waiting in it
+void wrxFreeInbox(void *inbox) {
+	wrxMessage m;
+
+	if (inbox == NULL) return;
+	while (wrxInboxGet(inbox, &m)) wrxClearMessage(&m);
+	free(inbox);
+}
+
+// release whatever a message's value owns
+void wrxClearMessage(wrxMessage *m) {
+	if (m->form == WRX_FORM_DATA || m->form == WRX_FORM_TABLE) free(m->p);
+		else if (m->form == WRX_FORM_BLOB) dwrxReleaseBlob(m->p);
+		else if (m->form == WRX_FORM_CHANNEL) wrxReleaseChannel(m->p);
+	m->form = WRX_FORM_NULL;
+}
+
+// WRX_MAIN_THREAD or a worker id
+void *wrxGetInbox(wrxState *p, int thread) {
+	if (thread == WRX_MAIN_THREAD) return p->inbox;
+	if (thread < 0 || thread >= p->threads + p->ioThreads || p->thread[thread] == NULL) return NULL;
+	return p->thread[thread]->inbox;
+}
+
+// copy m into the inbox, WRX_NOPE if it is full
+int wrxInboxPut(void *inbox, wrxMessage *m) {
+	wrxInbox *b = inbox;
+	wrxMessage *c;
+	unsigned int pos = xatomic_load_relaxed(&b->tail);
+	int dif;
+
+	for (;;) {
+		c = &b->ring[pos & (WRX_INBOX_SIZE - 1)];
+		dif = (int)(xatomic_load(&c->seq) - pos);
+		if (dif == 0) {
+			if (xatomic_cas(&b->tail, &pos, pos + 1)) break;
+		} else if (dif < 0) {
+			return WRX_NOPE;
+		} else {
+			pos = xatomic_load_relaxed(&b->tail);
+		}
+	}
+	memcpy((char*)c + sizeof(c->seq), (char*)m + sizeof(m->seq), sizeof(wrxMessage) - sizeof(m->seq));
+	xatomic_store(&c->seq, pos + 1);
+	return WRX_OK;
+}
+
+// take the oldest message, only ever called by the owning thread
+int wrxInboxGet(void *inbox, wrxMessage *m) {
+	wrxInbox *b = inbox;
+	unsigned int pos = b->head;
+	wrxMessage *c = &b->ring[pos & (WRX_INBOX_SIZE - 1)];
+
+	if (xatomic_load(&c->seq) != pos + 1) return WRX_NOPE;
+	memcpy(m, c, sizeof(wrxMessage));
+	xatomic_store(&c->seq, pos + WRX_INBOX_SIZE);
+	b->head = pos + 1;
+	return WRX_OK;
+}
+
+// hand everything that was in the inbox on entry to func in one pass, messages
+// that arrive meanwhile wait for the next drain. returns the count handled
+int wrxInboxDrain(void *inbox, void (*func)(wrxMessage *m, void *arg), void *arg) {
+	wrxInbox *b = inbox;
+	unsigned int stop = xatomic_load(&b->tail);
+	wrxMessage m;
+	int n = 0;
+
+	while (b->head != stop && wrxInboxGet(inbox, &m)) {
+		func(&m, arg);
+		n++;
+	}
+	return n;
+}
+
+// *****************************************************************************
+// futures
+wrxFuture *wrxNewFuture() {
+	wrxFuture *f = calloc(1, sizeof(wrxFuture));
+
+	if (f != NULL) f->refs = 1;
+	return f;
+}
+
+void wrxFutureRetain(wrxFuture *f) {
+	xatomic_add(&f->refs, 1);
+}
+
+void wrxFutureRelease(wrxFuture *f) {
+	if (xatomic_sub(&f->refs, 1) > 0) return;
+	for (int i = 0; i < f->count; i++) dwrxClearInfo(&f->results[i]);
+	free(f->results);
+	free(f);
+}
+
+// the future takes the results array, it must come from malloc()
+void wrxFutureResolve(wrxState *p, wrxFuture *f, wrxInfo *results, int count) {
+	f->results = results;
+	f->count = count;
+	wrxJobDone(p, &f->status, WRX_FUTURE_DONE);
+}
+
+void wrxFutureFail(wrxState *p, wrxFuture *f, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(f->error, WRX_LINE, fmt, args);
+	va_end(args);
+	wrxJobDone(p, &f->status, WRX_FUTURE_FAILED);
+}
+
+void wrxFutureWait(wrxState *p, wrxFuture *f) {
+	wrxJobWait(p, &f->status);
+}
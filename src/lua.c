@@ -9,22 +9,101 @@
 #include "wrx.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 extern wrxState* _theState;
+static char wrxAwaiting;		// registry key, coroutine -> the future it waits on
+static char wrxTimers;			// registry key, timer id -> { func, handle, every }
+static char wrxSubscribers;		// registry key, subscription id -> { func, handle }
+static lua_Integer wrxTimerCount = 0;
+static lua_Integer wrxSubscriberCount = 0;
 
 // *********************************************************
 // forward defines for lua functions
 int lfwrxEmit(lua_State *L);
 int lfwrxShare(lua_State *L);
+int lfwrxSnapshot(lua_State *L);
+int lfwrxSubscribe(lua_State *L);
+int lfwrxCounter(lua_State *L);
+int lfwrxAccumulator(lua_State *L);
+int lfwrxAtomicGet(lua_State *L);
+int lfwrxAtomicSet(lua_State *L);
+int lfwrxAtomicAdd(lua_State *L);
+int lfwrxAtomicMax(lua_State *L);
+int lfwrxAtomicMin(lua_State *L);
+int lfwrxAtomicCas(lua_State *L);
+int lfwrxUnsubscribe(lua_State *L);
 int lfwrxPushIO(lua_State *L, void *mem, unsigned long bytes, unsigned int local);
+int lfwrxPushView(lua_State *L, void *mem, unsigned long bytes, unsigned int imode);
+int lfwrxPushBlob(lua_State *L, wrxBlob *b);
+wrxBlob *lwrxToBlob(lua_State *L, int index);
+int lfwrxBlob(lua_State *L);
+int lfwrxBlobGc(lua_State *L);
+int lfwrxPushChannel(lua_State *L, wrxChannel *c, int end);
+wrxChannel *lwrxToChannel(lua_State *L, int index, int *end);
+int lfwrxChannel(lua_State *L);
+int lfwrxChannelGc(lua_State *L);
 int lfwrxLoad(lua_State *L);
+int lfwrxSpawn(lua_State *L);
+int lfwrxSend(lua_State *L);
+int lfwrxReceive(lua_State *L);
+int lfwrxJob(lua_State *L);
+int lfwrxParallelFor(lua_State *L);
+int lfwrxStage(lua_State *L);
+int lfwrxAfter(lua_State *L);
+int lfwrxEvery(lua_State *L);
+int lfwrxCancel(lua_State *L);
+int lfwrxMemory(lua_State *L);
+int lfwrxAwait(lua_State *L);
+int lfwrxFutureDone(lua_State *L);
+int lfwrxFutureWait(lua_State *L);
+int lfwrxFutureResult(lua_State *L);
+int lfwrxFutureGc(lua_State *L);
+int lwrxIndexShare(lua_State *L);
+int lwrxNewIndexShare(lua_State *L);
+int lwrxIndexSnapshot(lua_State *L);
+int lwrxNewIndexSnapshot(lua_State *L);
+const char *lwrxMimeType(const char *name);
 
 // *********************************************************
 // back to the code
 luaL_Reg wrxFuncTable[] = {
 	{ "emit", lfwrxEmit },
 	{ "share", lfwrxShare },
+	{ "snapshot", lfwrxSnapshot },
+	{ "subscribe", lfwrxSubscribe },
+	{ "unsubscribe", lfwrxUnsubscribe },
+	{ "counter", lfwrxCounter },
+	{ "accumulator", lfwrxAccumulator },
     { "load", lfwrxLoad },
+	{ "job", lfwrxJob },
+	{ "spawn", lfwrxSpawn },
+	{ "send", lfwrxSend },
+	{ "receive", lfwrxReceive },
+	{ "await", lfwrxAwait },
+	{ "parallel_for", lfwrxParallelFor },
+	{ "stage", lfwrxStage },
+	{ "after", lfwrxAfter },
+	{ "every", lfwrxEvery },
+	{ "cancel", lfwrxCancel },
+	{ "memory", lfwrxMemory },
+	{ "blob", lfwrxBlob },
+	{ "channel", lfwrxChannel },
+	{ NULL, NULL } };
+
+luaL_Reg wrxAtomicTable[] = {
+	{ "get", lfwrxAtomicGet },
+	{ "set", lfwrxAtomicSet },
+	{ "add", lfwrxAtomicAdd },
+	{ "max", lfwrxAtomicMax },
+	{ "min", lfwrxAtomicMin },
+	{ "cas", lfwrxAtomicCas },
+	{ NULL, NULL } };
+
+luaL_Reg wrxFutureTable[] = {
+	{ "done", lfwrxFutureDone },
+	{ "wait", lfwrxFutureWait },
+	{ "result", lfwrxFutureResult },
 	{ NULL, NULL } };
 
 void lwrxRegister(lua_State *L) {
@@ -42,6 +121,9 @@ void lwrxRegister(lua_State *L) {
 	// make a table to hold our config
 	lua_newtable(L);
 		lua_setfield(L, -2, "cfg");
+	// which thread this lua state runs on
+	lua_pushinteger(L, lwrxGetThread(L) ? lwrxGetThread(L)->id : WRX_MAIN_THREAD);
+		lua_setfield(L, -2, "thread");
 
 	// register our functions into global wrx
 	int i = 0;
@@ -54,6 +136,49 @@ void lwrxRegister(lua_State *L) {
 	// all done with wrx, pop it
 	lua_pop(L, 1);
 
+	// futures, and the coroutines waiting on them
+	luaL_newmetatable(L, "wrx.future");
+	lua_newtable(L);
+	luaL_setfuncs(L, wrxFutureTable, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lfwrxFutureGc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &wrxAwaiting);
+	// share handles, the shares themselves outlive every lua state
+	luaL_newmetatable(L, "wrx.share");
+	lua_pushcfunction(L, lwrxIndexShare);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lwrxNewIndexShare);
+	lua_setfield(L, -2, "__newindex");
+	lua_pop(L, 1);
+	// the userdata inside a blob's memio, holding its reference
+	luaL_newmetatable(L, "wrx.blob");
+	lua_pushcfunction(L, lfwrxBlobGc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	// the userdata inside a channel end's memio
+	luaL_newmetatable(L, "wrx.channel");
+	lua_pushcfunction(L, lfwrxChannelGc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, "wrx.atomic");
+	lua_newtable(L);
+	luaL_setfuncs(L, wrxAtomicTable, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+	luaL_newmetatable(L, "wrx.snapshot");
+	lua_pushcfunction(L, lwrxIndexSnapshot);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lwrxNewIndexSnapshot);
+	lua_setfield(L, -2, "__newindex");
+	lua_pop(L, 1);
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &wrxTimers);
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &wrxSubscribers);
+
 	// remove unsafe functions
 	lua_pushnil(L);
 		lua_setglobal(L, "require");
@@ -80,7 +205,12 @@ const char *lwrxDataReader(lua_State *L, void *data, size_t *size)
 }
 
 int lwrxLoadString(wrxState *p, wrxData *src, const char *name) {
-	return lua_load(p->L, lwrxDataReader, src, name, NULL);
+	return lwrxLoadChunk(p->L, src, name);
+}
+
+// load src as a chunk into any lua state, main or worker
+int lwrxLoadChunk(lua_State *L, wrxData *src, const char *name) {
+	return lua_load(L, lwrxDataReader, src, name, NULL);
 }
 
 void lwrxFieldToInteger(wrxState *p, int index, const char *name, int *v) {
@@ -89,6 +219,12 @@ void lwrxFieldToInteger(wrxState *p, int index, const char *name, int *v) {
 	lua_pop(p->L, 1);
 }
 
+void lwrxFieldToBoolean(wrxState *p, int index, const char *name, int *v) {
+	lua_getfield(p->L, index, name);
+	*v = lua_toboolean(p->L, -1);
+	lua_pop(p->L, 1);
+}
+
 void lwrxFieldToString(wrxState *p, int index, const char *name, char *buffer, int bsize) {
 	lua_getfield(p->L, index, name);
 	strncpy(buffer, lua_tostring(p->L, -1), bsize);
@@ -107,16 +243,1106 @@ void lwrxFieldToDouble(wrxState *p, int index, const char *name, double *v) {
 	lua_pop(p->L, 1);
 }
 
+// the worker thread running this lua state, NULL for the main state
+wrxThread *lwrxGetThread(lua_State *L) {
+	return *(wrxThread**)lua_getextraspace(L);
+}
+
+// *********************************************************
+// tables packed into one buffer, so they can cross to another lua state.
+// each value is a tag byte then its payload, strings seen before are sent as
+// their index in the order they first appeared. a table met again is sent as
+// its index in the order tables were finished, so shared subtables stay
+// shared, and a table met again while it is still being packed is a cycle
+#define WRX_PACK_NIL		0
+#define WRX_PACK_FALSE		1
+#define WRX_PACK_TRUE		2
+#define WRX_PACK_INT8		3
+#define WRX_PACK_INT32		4
+#define WRX_PACK_INT64		5
+#define WRX_PACK_DOUBLE		6
+#define WRX_PACK_STRING		7		// varint length, bytes
+#define WRX_PACK_STRREF		8		// varint index of an earlier string
+#define WRX_PACK_TABLE		9		// u32 array count, u32 hash count, array values, hash pairs
+#define WRX_PACK_TABREF		10		// varint index of an earlier table
+
+#define WRX_PACK_DEPTH		64		// keeps the recursion off the end of the C stack
+
+typedef struct {
+	char *mem;
+	unsigned int length;
+	unsigned int size;
+	int strings;			// stack index of the string -> index table
+	int count;				// strings seen
+	int tables;				// stack index of the table -> index table, false while in progress
+	int finished;			// tables packed
+} wrxPacker;
+
+static int lwrxPackBytes(wrxPacker *pk, const void *b, unsigned int n) {
+	char *mem;
+	unsigned int size;
+
+	if (pk->length + n > pk->size) {
+		size = pk->size ? pk->size : 256;
+		while (size < pk->length + n) {
+			if (size > 0x7FFFFFFF) return WRX_ERR;
+			size *= 2;
+		}
+		if ((mem = realloc(pk->mem, size)) == NULL) return WRX_ERR;
+		pk->mem = mem;
+		pk->size = size;
+	}
+	memcpy(pk->mem + pk->length, b, n);
+	pk->length += n;
+	return WRX_OK;
+}
+
+static int lwrxPackVarint(wrxPacker *pk, unsigned long long v) {
+	unsigned char b[10];
+	int n = 0;
+
+	while (v >= 0x80) {
+		b[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	b[n++] = (unsigned char)v;
+	return lwrxPackBytes(pk, b, n);
+}
+
+static int lwrxPackTag(wrxPacker *pk, unsigned char tag) {
+	return lwrxPackBytes(pk, &tag, 1);
+}
+
+static int lwrxPackValue(lua_State *L, wrxPacker *pk, int index, int depth);
+
+static int lwrxPackFields(lua_State *L, wrxPacker *pk, int index, int depth) {
+	unsigned int narr, nhash = 0, at, i;
+	lua_Integer k;
+
+	if (depth > WRX_PACK_DEPTH || !lua_checkstack(L, 4)) return WRX_ERR;
+	lua_pushvalue(L, index);
+	switch (lua_rawget(L, pk->tables)) {
+		case LUA_TBOOLEAN:
+			// still on the way down, so it holds itself
+			lua_pop(L, 1);
+			return WRX_ERR;
+		case LUA_TNUMBER:
+			k = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			if (lwrxPackTag(pk, WRX_PACK_TABREF) != WRX_OK) return WRX_ERR;
+			return lwrxPackVarint(pk, k);
+	}
+	lua_pop(L, 1);
+	lua_pushvalue(L, index);
+	lua_pushboolean(L, 0);
+	lua_rawset(L, pk->tables);
+	// the array part is 1..n with no holes, everything else is a pair
+	narr = (unsigned int)lua_rawlen(L, index);
+	for (i = 1; i <= narr; i++) {
+		if (lua_rawgeti(L, index, i) == LUA_TNIL) narr = i - 1;
+		lua_pop(L, 1);
+	}
+	if (lwrxPackTag(pk, WRX_PACK_TABLE) != WRX_OK || lwrxPackBytes(pk, &narr, 4) != WRX_OK) return WRX_ERR;
+	// the hash count isn't known until we've walked it
+	at = pk->length;
+	if (lwrxPackBytes(pk, &nhash, 4) != WRX_OK) return WRX_ERR;
+	for (i = 1; i <= narr; i++) {
+		lua_rawgeti(L, index, i);
+		if (lwrxPackValue(L, pk, lua_gettop(L), depth) != WRX_OK) return WRX_ERR;
+		lua_pop(L, 1);
+	}
+	lua_pushnil(L);
+	while (lua_next(L, index) != 0) {
+		if (lua_isinteger(L, -2) && (k = lua_tointeger(L, -2)) >= 1 && k <= narr) {
+			lua_pop(L, 1);
+			continue;
+		}
+		if (lwrxPackValue(L, pk, lua_gettop(L) - 1, depth) != WRX_OK || lwrxPackValue(L, pk, lua_gettop(L), depth) != WRX_OK) return WRX_ERR;
+		lua_pop(L, 1);
+		nhash++;
+	}
+	memcpy(pk->mem + at, &nhash, 4);
+	lua_pushvalue(L, index);
+	lua_pushinteger(L, pk->finished++);
+	lua_rawset(L, pk->tables);
+	return WRX_OK;
+}
+
+static int lwrxPackValue(lua_State *L, wrxPacker *pk, int index, int depth) {
+	lua_Integer i;
+	double d;
+	const char *s;
+	size_t len;
+
+	switch (lua_type(L, index)) {
+		case LUA_TNIL:
+			return lwrxPackTag(pk, WRX_PACK_NIL);
+		case LUA_TBOOLEAN:
+			return lwrxPackTag(pk, lua_toboolean(L, index) ? WRX_PACK_TRUE : WRX_PACK_FALSE);
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index)) {
+				i = lua_tointeger(L, index);
+				if (i >= -128 && i <= 127) {
+					signed char c = (signed char)i;
+					if (lwrxPackTag(pk, WRX_PACK_INT8) != WRX_OK) return WRX_ERR;
+					return lwrxPackBytes(pk, &c, 1);
+				} else if (i >= INT32_MIN && i <= INT32_MAX) {
+					int32_t l = (int32_t)i;
+					if (lwrxPackTag(pk, WRX_PACK_INT32) != WRX_OK) return WRX_ERR;
+					return lwrxPackBytes(pk, &l, 4);
+				}
+				if (lwrxPackTag(pk, WRX_PACK_INT64) != WRX_OK) return WRX_ERR;
+				return lwrxPackBytes(pk, &i, 8);
+			}
+			d = lua_tonumber(L, index);
+			if (lwrxPackTag(pk, WRX_PACK_DOUBLE) != WRX_OK) return WRX_ERR;
+			return lwrxPackBytes(pk, &d, 8);
+		case LUA_TSTRING:
+			lua_pushvalue(L, index);
+			if (lua_rawget(L, pk->strings) == LUA_TNUMBER) {
+				i = lua_tointeger(L, -1);
+				lua_pop(L, 1);
+				if (lwrxPackTag(pk, WRX_PACK_STRREF) != WRX_OK) return WRX_ERR;
+				return lwrxPackVarint(pk, i);
+			}
+			lua_pop(L, 1);
+			lua_pushvalue(L, index);
+			lua_pushinteger(L, pk->count++);
+			lua_rawset(L, pk->strings);
+			s = lua_tolstring(L, index, &len);
+			if (lwrxPackTag(pk, WRX_PACK_STRING) != WRX_OK || lwrxPackVarint(pk, len) != WRX_OK) return WRX_ERR;
+			return lwrxPackBytes(pk, s, len);
+		case LUA_TTABLE:
+			return lwrxPackFields(L, pk, index, depth + 1);
+	}
+	// functions, userdata, threads and blobs nested in a table don't pack
+	return WRX_ERR;
+}
+
+// pack the table at index into d, WRX_ERR when it holds something that can't
+// be packed, loops back on itself or nests deeper than WRX_PACK_DEPTH
+int lwrxPackTable(lua_State *L, int index, wrxData *d) {
+	wrxPacker pk;
+	int top = lua_gettop(L), ret;
+
+	memset(&pk, 0, sizeof(wrxPacker));
+	index = lua_absindex(L, index);
+	lua_newtable(L);
+	pk.strings = lua_gettop(L);
+	lua_newtable(L);
+	pk.tables = lua_gettop(L);
+	ret = lwrxPackValue(L, &pk, index, 0);
+	lua_settop(L, top);
+	if (ret != WRX_OK) {
+		free(pk.mem);
+		return WRX_ERR;
+	}
+	// trim it, the buffer gets copied around whole
+	memset(d, 0, sizeof(wrxData));
+	d->memory = realloc(pk.mem, pk.length);
+	if (d->memory == NULL) d->memory = pk.mem;
+	d->bytes = d->count = pk.length;
+	d->flags = WRX_DATA_PACKED;
+	return WRX_OK;
+}
+
+typedef struct {
+	const unsigned char *at;
+	const unsigned char *end;
+	const char **string;	// where each string starts, and its length
+	size_t *length;
+	int count;
+	int size;
+	int tables;				// stack index of the finished tables, in order
+	int finished;
+} wrxUnpacker;
+
+static int lwrxUnpackVarint(wrxUnpacker *up, unsigned long long *v) {
+	int shift = 0;
+
+	*v = 0;
+	while (up->at < up->end && shift < 64) {
+		*v |= (unsigned long long)(*up->at & 0x7F) << shift;
+		if (!(*up->at++ & 0x80)) return WRX_OK;
+		shift += 7;
+	}
+	return WRX_ERR;
+}
+
+#define WRX_UNPACK_NEED(up, n)	if ((size_t)((up)->end - (up)->at) < (size_t)(n)) return WRX_ERR
+
+// push the next value, WRX_ERR when the buffer is cut short or malformed
+static int lwrxUnpackValue(lua_State *L, wrxUnpacker *up, int depth) {
+	unsigned long long v;
+	unsigned int narr, nhash, i;
+	lua_Integer l;
+	int32_t w;
+	double d;
+
+	WRX_UNPACK_NEED(up, 1);
+	if (depth > WRX_PACK_DEPTH || !lua_checkstack(L, 3)) return WRX_ERR;
+	switch (*up->at++) {
+		case WRX_PACK_NIL:
+			lua_pushnil(L);
+			break;
+		case WRX_PACK_FALSE:
+			lua_pushboolean(L, 0);
+			break;
+		case WRX_PACK_TRUE:
+			lua_pushboolean(L, 1);
+			break;
+		case WRX_PACK_INT8:
+			WRX_UNPACK_NEED(up, 1);
+			lua_pushinteger(L, (signed char)*up->at++);
+			break;
+		case WRX_PACK_INT32:
+			WRX_UNPACK_NEED(up, 4);
+			memcpy(&w, up->at, 4);
+			up->at += 4;
+			lua_pushinteger(L, w);
+			break;
+		case WRX_PACK_INT64:
+			WRX_UNPACK_NEED(up, 8);
+			memcpy(&l, up->at, 8);
+			up->at += 8;
+			lua_pushinteger(L, l);
+			break;
+		case WRX_PACK_DOUBLE:
+			WRX_UNPACK_NEED(up, 8);
+			memcpy(&d, up->at, 8);
+			up->at += 8;
+			lua_pushnumber(L, d);
+			break;
+		case WRX_PACK_STRING:
+			if (lwrxUnpackVarint(up, &v) != WRX_OK) return WRX_ERR;
+			WRX_UNPACK_NEED(up, v);
+			if (up->count == up->size) {
+				int size = up->size ? up->size * 2 : 32;
+				const char **string = realloc(up->string, size * sizeof(char*));
+				size_t *length;
+				if (string == NULL) return WRX_ERR;
+				up->string = string;
+				if ((length = realloc(up->length, size * sizeof(size_t))) == NULL) return WRX_ERR;
+				up->length = length;
+				up->size = size;
+			}
+			up->string[up->count] = (const char*)up->at;
+			up->length[up->count++] = v;
+			lua_pushlstring(L, (const char*)up->at, v);
+			up->at += v;
+			break;
+		case WRX_PACK_STRREF:
+			if (lwrxUnpackVarint(up, &v) != WRX_OK || v >= (unsigned long long)up->count) return WRX_ERR;
+			lua_pushlstring(L, up->string[v], up->length[v]);
+			break;
+		case WRX_PACK_TABLE:
+			WRX_UNPACK_NEED(up, 8);
+			memcpy(&narr, up->at, 4);
+			memcpy(&nhash, up->at + 4, 4);
+			up->at += 8;
+			// each entry takes at least a byte, so a bad count can't make us allocate much
+			if (narr > up->end - up->at || nhash > up->end - up->at) return WRX_ERR;
+			lua_createtable(L, narr, nhash);
+			for (i = 1; i <= narr; i++) {
+				if (lwrxUnpackValue(L, up, depth + 1) != WRX_OK) return WRX_ERR;
+				lua_rawseti(L, -2, i);
+			}
+			for (i = 0; i < nhash; i++) {
+				if (lwrxUnpackValue(L, up, depth + 1) != WRX_OK) return WRX_ERR;
+				if (lwrxUnpackValue(L, up, depth + 1) != WRX_OK) return WRX_ERR;
+				if (lua_isnil(L, -2)) return WRX_ERR;
+				lua_rawset(L, -3);
+			}
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, up->tables, ++up->finished);
+			break;
+		case WRX_PACK_TABREF:
+			if (lwrxUnpackVarint(up, &v) != WRX_OK || v >= (unsigned long long)up->finished) return WRX_ERR;
+			lua_rawgeti(L, up->tables, v + 1);
+			break;
+		default:
+			return WRX_ERR;
+	}
+	return WRX_OK;
+}
+
+// push the table packed in d, or nil if d doesn't hold one
+int lwrxUnpackTable(lua_State *L, wrxData *d) {
+	wrxUnpacker up;
+	int top = lua_gettop(L), ret;
+
+	memset(&up, 0, sizeof(wrxUnpacker));
+	up.at = d->memory;
+	up.end = up.at + d->count;
+	lua_newtable(L);
+	up.tables = lua_gettop(L);
+	ret = lwrxUnpackValue(L, &up, 0);
+	free(up.string);
+	free(up.length);
+	if (ret != WRX_OK || up.at != up.end) {
+		lua_settop(L, top);
+		lua_pushnil(L);
+		return WRX_ERR;
+	}
+	lua_remove(L, up.tables);
+	return WRX_OK;
+}
+
+// copy the lua value at index into v, so it can cross to another lua state
+int lwrxToInfo(lua_State *L, int index, wrxInfo *v) {
+	const char *s;
+	size_t len;
+
+	switch (lua_type(L, index)) {
+		case LUA_TNIL:
+			v->form = WRX_FORM_NULL;
+			break;
+		case LUA_TBOOLEAN:
+			v->form = WRX_FORM_BOOLEAN;
+			v->i[0] = lua_toboolean(L, index);
+			break;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index)) {
+				v->form = WRX_FORM_INTEGER;
+				v->l[0] = lua_tointeger(L, index);
+			} else {
+				v->form = WRX_FORM_DOUBLE;
+				v->d[0] = lua_tonumber(L, index);
+			}
+			break;
+		case LUA_TSTRING:
+			s = lua_tolstring(L, index, &len);
+			if (len < sizeof(v->str) && strlen(s) == len) {
+				v->form = WRX_FORM_STRING;
+				memcpy(v->str, s, len + 1);
+			} else {
+				// too long, or holds zeros, so keep it as data
+				v->data.memory = malloc(len + 1);
+				if (v->data.memory == NULL) return WRX_ERR;
+				memcpy(v->data.memory, s, len + 1);
+				v->data.bytes = len + 1;
+				v->data.count = len;
+				v->data.flags = WRX_DATA_UTF8;
+				v->form = WRX_FORM_DATA;
+			}
+			break;
+		case LUA_TTABLE:
+			// a blob's or channel's memio crosses without a copy, any other table is packed
+			if ((v->p = lwrxToBlob(L, index)) != NULL) {
+				dwrxRetainBlob(v->p);
+				v->form = WRX_FORM_BLOB;
+			} else if ((v->p = lwrxToChannel(L, index, &v->i[2])) != NULL) {
+				wrxRetainChannel(v->p);
+				v->form = WRX_FORM_CHANNEL;
+			} else if (lwrxPackTable(L, index, &v->data) == WRX_OK) {
+				v->form = WRX_FORM_TABLE;
+			} else return WRX_ERR;
+			break;
+		default:
+			return WRX_ERR;
+	}
+	return WRX_OK;
+}
+
+// push a value copied with lwrxToInfo()
+void lwrxPushInfo(lua_State *L, wrxInfo *v) {
+	switch (v->form) {
+		case WRX_FORM_BOOLEAN:
+			lua_pushboolean(L, v->i[0]);
+			break;
+		case WRX_FORM_INTEGER:
+			lua_pushinteger(L, v->l[0]);
+			break;
+		case WRX_FORM_DOUBLE:
+			lua_pushnumber(L, v->d[0]);
+			break;
+		case WRX_FORM_STRING:
+			lua_pushstring(L, v->str);
+			break;
+		case WRX_FORM_DATA:
+			lua_pushlstring(L, v->data.memory, v->data.count);
+			break;
+		case WRX_FORM_BLOB:
+			dwrxRetainBlob(v->p);
+			lfwrxPushBlob(L, v->p);
+			break;
+		case WRX_FORM_CHANNEL:
+			wrxRetainChannel(v->p);
+			lfwrxPushChannel(L, v->p, v->i[2]);
+			break;
+		case WRX_FORM_TABLE:
+			lwrxUnpackTable(L, &v->data);
+			break;
+		default:
+			lua_pushnil(L);
+			break;
+	}
+}
+
+// copy the lua value at index into a message
+int lwrxToMessage(lua_State *L, int index, wrxMessage *m) {
+	const char *s;
+	size_t len;
+
+	switch (lua_type(L, index)) {
+		case LUA_TNIL:
+			m->form = WRX_FORM_NULL;
+			break;
+		case LUA_TBOOLEAN:
+			m->form = WRX_FORM_BOOLEAN;
+			m->l = lua_toboolean(L, index);
+			break;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index)) {
+				m->form = WRX_FORM_INTEGER;
+				m->l = lua_tointeger(L, index);
+			} else {
+				m->form = WRX_FORM_DOUBLE;
+				m->d = lua_tonumber(L, index);
+			}
+			break;
+		case LUA_TSTRING:
+			s = lua_tolstring(L, index, &len);
+			m->length = len;
+			if (len <= sizeof(m->str)) {
+				m->form = WRX_FORM_STRING;
+				memcpy(m->str, s, len);
+			} else {
+				m->form = WRX_FORM_DATA;
+				m->p = malloc(len);
+				if (m->p == NULL) return WRX_ERR;
+				memcpy(m->p, s, len);
+			}
+			break;
+		case LUA_TTABLE:
+			if ((m->p = lwrxToBlob(L, index)) != NULL) {
+				dwrxRetainBlob(m->p);
+				m->form = WRX_FORM_BLOB;
+			} else if ((m->p = lwrxToChannel(L, index, (int*)&m->length)) != NULL) {
+				wrxRetainChannel(m->p);
+				m->form = WRX_FORM_CHANNEL;
+			} else {
+				wrxData d;
+				if (lwrxPackTable(L, index, &d) != WRX_OK) return WRX_ERR;
+				m->form = WRX_FORM_TABLE;
+				m->p = d.memory;
+				m->length = d.count;
+			}
+			break;
+		default:
+			return WRX_ERR;
+	}
+	return WRX_OK;
+}
+
+// push a message's value, releasing anything it owned
+void lwrxPushMessage(lua_State *L, wrxMessage *m) {
+	switch (m->form) {
+		case WRX_FORM_BOOLEAN:
+			lua_pushboolean(L, (int)m->l);
+			break;
+		case WRX_FORM_INTEGER:
+			lua_pushinteger(L, m->l);
+			break;
+		case WRX_FORM_DOUBLE:
+			lua_pushnumber(L, m->d);
+			break;
+		case WRX_FORM_STRING:
+			lua_pushlstring(L, m->str, m->length);
+			break;
+		case WRX_FORM_DATA:
+			lua_pushlstring(L, m->p, m->length);
+			free(m->p);
+			break;
+		case WRX_FORM_BLOB:
+			// the memio takes over the message's reference
+			lfwrxPushBlob(L, m->p);
+			break;
+		case WRX_FORM_CHANNEL:
+			lfwrxPushChannel(L, m->p, m->length);
+			break;
+		case WRX_FORM_TABLE: {
+				wrxData d;
+				d.memory = m->p;
+				d.count = m->length;
+				lwrxUnpackTable(L, &d);
+				free(m->p);
+			}
+			break;
+		default:
+			lua_pushnil(L);
+			break;
+	}
+}
+
+void lwrxMessageHandler(wrxMessage *m, void *arg) {
+	lua_State *L = arg;
+
+	lua_pushvalue(L, -1);
+	lua_pushinteger(L, m->from);
+	lwrxPushMessage(L, m);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+		wrxError(_theState, "wrx.message() lua runtime error %s", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+}
+
+// once per update, hand the main inbox to wrx.message(from, value) if the app
+// has one, otherwise messages wait for wrx.receive()
+void lwrxDispatchMessages(wrxState *p) {
+	int top = lua_gettop(p->L);
+
+	lua_getglobal(p->L, "wrx");
+	lua_getfield(p->L, -1, "message");
+	if (lua_isfunction(p->L, -1)) wrxInboxDrain(p->inbox, lwrxMessageHandler, p->L);
+	lua_settop(p->L, top);
+}
+
+// *********************************************************
+// futures, what wrx.job(), wrx.spawn() and wrx.load() hand back
+
+wrxFuture *lwrxCheckFuture(lua_State *L, int index) {
+	return *(wrxFuture**)luaL_checkudata(L, index, "wrx.future");
+}
+
+// push a new handle for f, the handle takes over the caller's reference
+void lwrxPushFuture(lua_State *L, wrxFuture *f) {
+	wrxFuture **pf = lua_newuserdatauv(L, sizeof(wrxFuture*), 0);
+	*pf = f;
+	luaL_setmetatable(L, "wrx.future");
+}
+
+int lwrxFutureResults(lua_State *L, wrxFuture *f) {
+	if (xatomic_load(&f->status) == WRX_FUTURE_FAILED) return luaL_error(L, "%s", f->error);
+	luaL_checkstack(L, f->count, "future has too many results");
+	for (int i = 0; i < f->count; i++) lwrxPushInfo(L, &f->results[i]);
+	return f->count;
+}
+
+// -> future:done(), true once the work has finished or failed
+int lfwrxFutureDone(lua_State *L) {
+	wrxFuture *f = lwrxCheckFuture(L, 1);
+	lua_pushboolean(L, xatomic_load(&f->status) != WRX_FUTURE_PENDING);
+	return 1;
+}
+
+// -> future:wait(), block until the work finishes and return its results
+int lfwrxFutureWait(lua_State *L) {
+	wrxFuture *f = lwrxCheckFuture(L, 1);
+	wrxFutureWait(_theState, f);
+	return lwrxFutureResults(L, f);
+}
+
+// -> future:result(), the results, raises the error if the work failed
+int lfwrxFutureResult(lua_State *L) {
+	wrxFuture *f = lwrxCheckFuture(L, 1);
+	if (xatomic_load(&f->status) == WRX_FUTURE_PENDING) return luaL_error(L, "future:result() called before the work finished");
+	return lwrxFutureResults(L, f);
+}
+
+int lfwrxFutureGc(lua_State *L) {
+	wrxFuture **pf = luaL_checkudata(L, 1, "wrx.future");
+	if (*pf != NULL) wrxFutureRelease(*pf);
+	*pf = NULL;
+	return 0;
+}
+
+// file the running coroutine under the future at index 1, or take it out with nil
+static void lwrxSetAwaiting(lua_State *L, int waiting) {
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxAwaiting);
+	lua_pushthread(L);
+	if (waiting) lua_pushvalue(L, 1);
+		else lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+// resumed by lwrxResumeAwaiting() once the future is done. the app may
+// resume the coroutine itself before that, then it just waits again
+int lwrxAwaitK(lua_State *L, int status, lua_KContext ctx) {
+	wrxFuture *f = lwrxCheckFuture(L, 1);
+
+	lua_settop(L, 1);
+	if (xatomic_load(&f->status) == WRX_FUTURE_PENDING) {
+		lwrxSetAwaiting(L, 1);
+		return lua_yieldk(L, 0, 0, lwrxAwaitK);
+	}
+	lwrxSetAwaiting(L, 0);
+	return lwrxFutureResults(L, f);
+}
+
+// once per update, resume every coroutine whose future has finished
+void lwrxResumeAwaiting(wrxState *p) {
+	lua_State *L = p->L, *co;
+	int top = lua_gettop(L), n = 0, nres, ret;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxAwaiting);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, top + 1)) {
+		wrxFuture *f = *(wrxFuture**)lua_touserdata(L, -1);
+		if (xatomic_load(&f->status) != WRX_FUTURE_PENDING) {
+			lua_pushvalue(L, -2);
+			lua_rawseti(L, top + 2, ++n);
+		}
+		lua_pop(L, 1);
+	}
+	for (int i = 1; i <= n; i++) {
+		lua_rawgeti(L, top + 2, i);
+		co = lua_tothread(L, -1);
+		lua_pushnil(L);
+		lua_rawset(L, top + 1);
+		ret = lua_resume(co, L, 0, &nres);
+		if (ret == LUA_OK || ret == LUA_YIELD) {
+			lua_pop(co, nres);
+		} else {
+			wrxError(p, "wrx.await() lua runtime error %s", lua_tostring(co, -1));
+			lua_pop(co, 1);
+		}
+	}
+	lua_settop(L, top);
+}
+
+// *********************************************************
+// lua jobs: the function is moved to a worker's lua state as bytecode. its
+// _ENV is the worker's globals and every other upvalue arrives as nil, see
+// lwrxLoadCode(). spawned jobs carry the source of a module from the archive
+// instead
+typedef struct {
+	wrxFuture *future;
+	char *code;
+	size_t codeLength;
+	wrxInfo *source;
+	char name[WRX_LINE];
+	int nargs;
+	wrxInfo *args;
+} wrxLuaJob;
+
+void lwrxFreeJob(wrxLuaJob *j) {
+	for (int i = 0; i < j->nargs; i++) dwrxClearInfo(&j->args[i]);
+	free(j->args);
+	free(j->code);
+	if (j->source != NULL) dwrxFreeInfo(j->source);
+	wrxFutureRelease(j->future);
+	free(j);
+}
+
+// a job and the handle for its future, which is pushed
+wrxLuaJob *lwrxNewJob(lua_State *L) {
+	wrxLuaJob *j = calloc(1, sizeof(wrxLuaJob));
+
+	if (j == NULL || (j->future = wrxNewFuture()) == NULL) {
+		free(j);
+		luaL_error(L, "wrx.job() memory allocation failure");
+		return NULL;
+	}
+	// the handle holds one reference, the job the other
+	wrxFutureRetain(j->future);
+	lwrxPushFuture(L, j->future);
+	return j;
+}
+
+int lwrxCodeWriter(lua_State *L, const void *b, size_t size, void *ud) {
+	wrxLuaJob *j = ud;
+	char *n = realloc(j->code, j->codeLength + size);
+
+	if (n == NULL) return 1;
+	memcpy(n + j->codeLength, b, size);
+	j->code = n;
+	j->codeLength += size;
+	return 0;
+}
+
+// load a function dumped with lwrxCodeWriter. luaL_loadbufferx() hands the
+// globals to the first upvalue whatever it is, so they are set by name: _ENV
+// gets the globals of L and the rest, the locals it closed over, get nil
+int lwrxLoadCode(lua_State *L, const char *code, size_t length, const char *name) {
+	const char *up;
+	int i, ret;
+
+	ret = luaL_loadbufferx(L, code, length, name, "b");
+	if (ret != LUA_OK) return ret;
+	for (i = 1; (up = lua_getupvalue(L, -1, i)) != NULL; i++) {
+		lua_pop(L, 1);
+		if (!strcmp(up, "_ENV")) lua_pushglobaltable(L);
+			else lua_pushnil(L);
+		lua_setupvalue(L, -2, i);
+	}
+	return LUA_OK;
+}
+
+// runs on a worker
+void lwrxRunJob(wrxThread *t, void *arg) {
+	wrxLuaJob *j = arg;
+	lua_State *L = t->L;
+	wrxInfo *results;
+	int top, i, n, ret;
+
+	if (L == NULL) {
+		wrxFutureFail(t->state, j->future, "wrx.job() worker has no lua state");
+		lwrxFreeJob(j);
+		return;
+	}
+
+	top = lua_gettop(L);
+	if (j->source != NULL) ret = lwrxLoadChunk(L, &j->source->data, j->name);
+		else ret = lwrxLoadCode(L, j->code, j->codeLength, "=wrx.job");
+	if (ret == LUA_OK) {
+		for (i = 0; i < j->nargs; i++) lwrxPushInfo(L, &j->args[i]);
+		ret = lua_pcall(L, j->nargs, LUA_MULTRET, 0);
+	}
+	if (ret == LUA_OK) {
+		n = lua_gettop(L) - top;
+		results = (n > 0) ? calloc(n, sizeof(wrxInfo)) : NULL;
+		if (n > 0 && results == NULL) {
+			wrxFutureFail(t->state, j->future, "wrx.job() memory allocation failure");
+		} else {
+			for (i = 0; i < n; i++) {
+				if (lwrxToInfo(L, top + 1 + i, &results[i]) != WRX_OK) {
+					wrxFutureFail(t->state, j->future, "wrx.job() can't return a %s", luaL_typename(L, top + 1 + i));
+					while (i-- > 0) dwrxClearInfo(&results[i]);
+					free(results);
+					break;
+				}
+			}
+			if (i == n) wrxFutureResolve(t->state, j->future, results, n);
+		}
+	} else {
+		const char *e = lua_tostring(L, -1);
+		wrxFutureFail(t->state, j->future, "%s", e ? e : "wrx.job() error");
+	}
+	lua_settop(L, top);
+	lwrxFreeJob(j);
+}
+
+// copy the arguments after the first, then hand the job to the pool, the
+// job's future is on top of the stack
+int lwrxSubmitJob(lua_State *L, wrxLuaJob *j) {
+	int i;
+
+	j->nargs = lua_gettop(L) - 2;
+	j->args = calloc(j->nargs, sizeof(wrxInfo));
+	if (j->nargs > 0 && j->args == NULL) {
+		lwrxFreeJob(j);
+		return luaL_error(L, "wrx.job() memory allocation failure");
+	}
+	for (i = 0; i < j->nargs; i++) {
+		if (lwrxToInfo(L, i + 2, &j->args[i]) != WRX_OK) {
+			j->nargs = i;
+			lwrxFreeJob(j);
+			return luaL_argerror(L, i + 2, "can't move this value to a worker");
+		}
+	}
+
+	if (wrxJobSubmit(_theState, lwrxRunJob, j) != WRX_OK) {
+		lwrxFreeJob(j);
+		return luaL_error(L, "no worker threads are running");
+	}
+	return 1;
+}
+
+// *********************************************************
+// async loads
+typedef struct {
+	wrxFuture *future;
+	char name[WRX_LINE];
+	char mime[124];				// as much as the string it resolves with holds
+} wrxLoad;
+
+// runs on a worker, resolves to the file's contents and its mime type
+void lwrxRunLoad(wrxThread *t, void *arg) {
+	wrxLoad *ld = arg;
+	wrxInfo *src = dwrxReadFile(ld->name);
+	wrxInfo *results;
+
+	if (src == NULL) {
+		wrxFutureFail(t->state, ld->future, "wrx.load() could not locate %s", ld->name);
+	} else if ((results = calloc(2, sizeof(wrxInfo))) == NULL) {
+		dwrxFreeInfo(src);
+		wrxFutureFail(t->state, ld->future, "wrx.load() memory allocation failure");
+	} else {
+		memcpy(&results[0], src, sizeof(wrxInfo));
+		free(src);
+		results[1].form = WRX_FORM_STRING;
+		snprintf(results[1].str, sizeof(results[1].str), "%s", ld->mime);
+		wrxFutureResolve(t->state, ld->future, results, 2);
+	}
+	wrxFutureRelease(ld->future);
+	free(ld);
+}
+
+// *********************************************************
+// parallel for over a memio, each range gets the kernel on whichever worker
+// claimed it
+typedef struct {
+	wrxLuaJob job;				// the lua kernel's code and the extra arguments
+	wrxKernelFunc kernel;		// or a named C kernel
+	unsigned int imode;
+	int failed;
+	char error[WRX_LINE];
+} wrxLuaRange;
+
+// runs on a worker, kernel(view, offset, ...) where view is a memio over the range
+void lwrxRunRange(wrxThread *t, char *mem, unsigned int offset, unsigned int length, void *arg) {
+	wrxLuaRange *r = arg;
+	lua_State *L = t->L;
+	int top, i, ret, e = 0;
+
+	if (xatomic_load(&r->failed)) return;
+	if (r->kernel != NULL) {
+		r->kernel(mem, offset, length, r->job.args, r->job.nargs);
+		return;
+	}
+
+	top = lua_gettop(L);
+	ret = lwrxLoadCode(L, r->job.code, r->job.codeLength, "=wrx.parallel_for");
+	if (ret == LUA_OK) {
+		lfwrxPushView(L, mem, length, r->imode);
+		lua_pushinteger(L, offset);
+		for (i = 0; i < r->job.nargs; i++) lwrxPushInfo(L, &r->job.args[i]);
+		ret = lua_pcall(L, 2 + r->job.nargs, 0, 0);
+	}
+	// only the first error is kept
+	if (ret != LUA_OK && xatomic_cas(&r->failed, &e, 1)) {
+		strncpy(r->error, lua_tostring(L, -1) ? lua_tostring(L, -1) : "wrx.parallel_for() error", WRX_LINE - 1);
+	}
+	lua_settop(L, top);
+}
+
+// *********************************************************
+// frame stages written in lua, main stages call the function in the main
+// state, worker stages load its bytecode into whichever state runs them
+typedef struct {
+	char name[32];
+	int ref;					// the function, in the main state's registry
+	wrxLuaJob job;				// its code, for worker stages
+} wrxLuaStage;
+
+// stage(dt) each frame
+void lwrxRunStage(wrxState *p, wrxThread *t, void *arg) {
+	wrxLuaStage *s = arg;
+	lua_State *L = (t != NULL) ? t->L : p->L;
+	int top = lua_gettop(L), ret = LUA_OK;
+
+	// a worker stage the pool turned away runs on the main thread instead, from
+	// its bytecode too so it sees the same globals and no captured locals
+	if (s->job.code != NULL) ret = lwrxLoadCode(L, s->job.code, s->job.codeLength, s->name);
+		else lua_rawgeti(L, LUA_REGISTRYINDEX, s->ref);
+	if (ret == LUA_OK) {
+		lua_pushnumber(L, p->dt);
+		ret = lua_pcall(L, 1, 0, 0);
+	}
+	if (ret != LUA_OK) wrxError(p, "wrx.stage() %s lua runtime error %s", s->name, lua_tostring(L, -1));
+	lua_settop(L, top);
+}
+
+// *********************************************************
+// timers, the wheel hands back the id and the function is looked up by it
+void lwrxFireTimer(wrxState *p, void *arg) {
+	lua_State *L = p->L;
+	lua_Integer id = (intptr_t)arg;
+	int top = lua_gettop(L);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxTimers);
+	if (lua_rawgeti(L, top + 1, id) == LUA_TTABLE) {
+		// a one shot is gone before it runs, so wrx.cancel() from it finds nothing
+		if (lua_rawgeti(L, top + 2, 3) == LUA_TNIL) {
+			lua_pushnil(L);
+			lua_rawseti(L, top + 1, id);
+		}
+		lua_rawgeti(L, top + 2, 1);
+		lua_pushinteger(L, id);
+		if (lua_pcall(L, 1, 0, 0) != LUA_OK) wrxError(p, "wrx timer lua runtime error %s", lua_tostring(L, -1));
+	}
+	lua_settop(L, top);
+}
+
+int lwrxAddTimer(lua_State *L, int every) {
+	lua_Integer ms = luaL_checkinteger(L, 1);
+	lua_Integer id;
+	void *h;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (lwrxGetThread(L) != NULL) return luaL_error(L, "timers can only be set from the main state");
+	if (ms < 0) ms = 0;
+	if (ms > 0x7FFFFFFF) ms = 0x7FFFFFFF;
+	if (every && ms == 0) ms = 1;
+
+	id = ++wrxTimerCount;
+	h = wrxAddTimer(_theState, ms, every ? ms : 0, lwrxFireTimer, (void*)(intptr_t)id);
+	if (h == NULL) return luaL_error(L, "%s", _theState->error);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxTimers);
+	lua_createtable(L, 3, 0);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_pushlightuserdata(L, h);
+	lua_rawseti(L, -2, 2);
+	if (every) {
+		lua_pushboolean(L, 1);
+		lua_rawseti(L, -2, 3);
+	}
+	lua_rawseti(L, -2, id);
+	lua_pop(L, 1);
+	lua_pushinteger(L, id);
+	return 1;
+}
+
 // *********************************************************
 // lua multithreading shares
+
+wrxShare *lwrxCheckShare(lua_State *L, int index) {
+	return *(wrxShare**)luaL_checkudata(L, index, "wrx.share");
+}
+
+// -> share[key], nil when the key isn't set
 int lwrxIndexShare(lua_State *L) {
-	return 0;
+	wrxShare *s = lwrxCheckShare(L, 1);
+	const char *key = luaL_checkstring(L, 2);
+	wrxInfo v;
+
+	if (wrxShareGet(s, key, &v) != WRX_OK) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lwrxPushInfo(L, &v);
+	dwrxClearInfo(&v);
+	return 1;
 }
 
+// -> share[key] = value, nil removes the key
 int lwrxNewIndexShare(lua_State *L) {
+	wrxShare *s = lwrxCheckShare(L, 1);
+	const char *key = luaL_checkstring(L, 2);
+	wrxInfo v;
+
+	if (strlen(key) >= sizeof(v.name)) luaL_argerror(L, 2, "share key too long");
+	if (lwrxToInfo(L, 3, &v) != WRX_OK) luaL_argerror(L, 3, "shares hold nil, booleans, numbers, strings, tables, blobs or channels");
+	if (wrxShareSet(s, key, &v) != WRX_OK) return luaL_error(L, "share %s out of memory", s->shareName.name);
 	return 0;
 }
 
+// a snapshot handle, only good while its thread's pin is
+typedef struct {
+	const void *version;
+	wrxEpochSlot *slot;
+	unsigned int generation;
+} wrxLuaSnapshot;
+
+// -> snapshot[key], nil when the key wasn't set
+int lwrxIndexSnapshot(lua_State *L) {
+	wrxLuaSnapshot *ls = luaL_checkudata(L, 1, "wrx.snapshot");
+	const char *key = luaL_checkstring(L, 2);
+	const wrxInfo *v;
+
+	if (ls->slot->generation != ls->generation) return luaL_error(L, "snapshot used after the job or frame it was taken in");
+	v = wrxSnapshotGet(ls->version, key);
+	if (v != NULL) lwrxPushInfo(L, (wrxInfo*)v);
+		else lua_pushnil(L);
+	return 1;
+}
+
+int lwrxNewIndexSnapshot(lua_State *L) {
+	return luaL_error(L, "snapshots are read only");
+}
+
+// counters and accumulators, handles straight to a share's atomic so updates
+// take no locks
+wrxShareAtomic *lwrxCheckAtomic(lua_State *L, int index) {
+	return *(wrxShareAtomic**)luaL_checkudata(L, index, "wrx.atomic");
+}
+
+// the number at index as an argument for a
+void lwrxAtomicArg(lua_State *L, wrxShareAtomic *a, int index, wrxInfo *v) {
+	if (a->form == WRX_FORM_INTEGER) {
+		v->form = WRX_FORM_INTEGER;
+		v->l[0] = luaL_checkinteger(L, index);
+	} else {
+		v->form = WRX_FORM_DOUBLE;
+		v->d[0] = luaL_checknumber(L, index);
+	}
+}
+
+int lwrxNewAtomic(lua_State *L, int form) {
+	const char *key = luaL_checkstring(L, 2);
+	wrxShareAtomic *a, **pa;
+	wrxShare *s;
+
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		s = wrxGetShare(_theState, lua_tostring(L, 1));
+		if (s == NULL) return luaL_error(L, "%s", wrxGetError(_theState));
+	} else s = lwrxCheckShare(L, 1);
+	if (strlen(key) >= sizeof(a->key)) luaL_argerror(L, 2, "share key too long");
+	a = wrxShareGetAtomic(s, key, form);
+	if (a == NULL) return luaL_error(L, "%s in share %s is already a %s", key, s->shareName.name, (form == WRX_FORM_INTEGER) ? "accumulator" : "counter");
+	pa = lua_newuserdatauv(L, sizeof(wrxShareAtomic*), 0);
+	*pa = a;
+	luaL_setmetatable(L, "wrx.atomic");
+	return 1;
+}
+
+int lwrxAtomicUpdate(lua_State *L, int op) {
+	wrxShareAtomic *a = lwrxCheckAtomic(L, 1);
+	wrxInfo v;
+
+	lwrxAtomicArg(L, a, 2, &v);
+	wrxAtomicUpdate(a, op, &v);
+	lwrxPushInfo(L, &v);
+	return 1;
+}
+
+// -> atomic:get()
+int lfwrxAtomicGet(lua_State *L) {
+	wrxInfo v;
+
+	wrxAtomicLoad(lwrxCheckAtomic(L, 1), &v);
+	lwrxPushInfo(L, &v);
+	return 1;
+}
+
+// -> atomic:set(v), atomic:add(v), atomic:max(v), atomic:min(v), each returns the new value
+int lfwrxAtomicSet(lua_State *L) { return lwrxAtomicUpdate(L, WRX_ATOMIC_SET); }
+int lfwrxAtomicAdd(lua_State *L) { return lwrxAtomicUpdate(L, WRX_ATOMIC_ADD); }
+int lfwrxAtomicMax(lua_State *L) { return lwrxAtomicUpdate(L, WRX_ATOMIC_MAX); }
+int lfwrxAtomicMin(lua_State *L) { return lwrxAtomicUpdate(L, WRX_ATOMIC_MIN); }
+
+// -> ok, value = atomic:cas(expected, v), value is what it held before
+int lfwrxAtomicCas(lua_State *L) {
+	wrxShareAtomic *a = lwrxCheckAtomic(L, 1);
+	wrxInfo expect, v;
+
+	lwrxAtomicArg(L, a, 2, &expect);
+	lwrxAtomicArg(L, a, 3, &v);
+	lua_pushboolean(L, wrxAtomicCas(a, &expect, &v) == WRX_OK);
+	lwrxPushInfo(L, &expect);
+	return 2;
+}
+
+// a share's batch of changes for the frame, handed to the subscriber as a
+// table of changed keys and a list of removed ones
+void lwrxShareChanged(wrxState *p, wrxShare *s, wrxInfo *changes, int count, void *arg) {
+	lua_State *L = p->L;
+	lua_Integer id = (intptr_t)arg;
+	int top = lua_gettop(L), removed = 0;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxSubscribers);
+	if (lua_rawgeti(L, top + 1, id) == LUA_TTABLE) {
+		lua_rawgeti(L, top + 2, 1);
+		lua_createtable(L, 0, count);
+		lua_newtable(L);
+		for (int i = 0; i < count; i++) {
+			if (changes[i].form == WRX_FORM_NULL) {
+				lua_pushstring(L, changes[i].name);
+				lua_rawseti(L, top + 5, ++removed);
+			} else {
+				lwrxPushInfo(L, &changes[i]);
+				lua_setfield(L, top + 4, changes[i].name);
+			}
+		}
+		if (lua_pcall(L, 2, 0, 0) != LUA_OK) wrxError(p, "wrx.subscribe() %s lua runtime error %s", s->shareName.name, lua_tostring(L, -1));
+	}
+	lua_settop(L, top);
+}
+
 // *********************************************************
 // mime types
 
@@ -172,6 +1398,18 @@ wrxMimeType wrxMimeTable[] = {
     { NULL, NULL, NULL }
 };
 
+// the mime type for a file name, by its extension
+const char *lwrxMimeType(const char *name) {
+    const char *ext = strrchr(name, '.');
+
+    if (ext != NULL) {
+        for (int i = 0; wrxMimeTable[i].ext != NULL; i++) {
+            if (!strcmp(ext, wrxMimeTable[i].ext)) return wrxMimeTable[i].mime;
+        }
+    }
+    return "application/octet-stream";
+}
+
 // *********************************************************
 // wrx functions
 int lfwrxEmit(lua_State *L) {
@@ -180,22 +1418,486 @@ int lfwrxEmit(lua_State *L) {
 	return 0;
 }
 
+/*
+	share = wrx.share(name)
+
+	the shared table called name, every lua state asking for name gets the
+	same one. it holds nil, booleans, numbers, strings, tables, blobs or
+	channels under string keys, a table is copied in and out whole
+*/
 int lfwrxShare(lua_State *L) {
-	// first the metatable
-	lua_newtable(L);
-	// now the actual table
-	lua_newtable(L);
-	lua_pushcfunction(L, lwrxIndexShare);
-    lua_setfield(L, -2, "__index");
-    lua_pushcfunction(L, lwrxNewIndexShare);
-    lua_setfield(L, -2, "__newindex");
-    lua_setmetatable(L, -2);
+	const char *name = luaL_checkstring(L, 1);
+	wrxShare *s = wrxGetShare(_theState, name);
+	wrxShare **ps;
+
+	if (s == NULL) return luaL_error(L, "%s", wrxGetError(_theState));
+	ps = lua_newuserdatauv(L, sizeof(wrxShare*), 0);
+	*ps = s;
+	luaL_setmetatable(L, "wrx.share");
 	return 1;
 }
 
-// loadtask = wrx.load(filename, mimetype (or NULL))
-int lfwrxLoad(lua_State *L) {
+/*
+	view = wrx.snapshot(share or name)
+
+	a read only view of a share as it was at the start of the frame, the same
+	for every reader that frame. a view lasts until the job that took it ends,
+	or on the main thread until the next frame
+*/
+int lfwrxSnapshot(lua_State *L) {
+	wrxThread *t = lwrxGetThread(L);
+	wrxLuaSnapshot *ls;
+	wrxShare *s;
+
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		s = wrxGetShare(_theState, lua_tostring(L, 1));
+		if (s == NULL) return luaL_error(L, "%s", wrxGetError(_theState));
+	} else s = lwrxCheckShare(L, 1);
+
+	ls = lua_newuserdatauv(L, sizeof(wrxLuaSnapshot), 0);
+	ls->version = wrxShareSnapshot(_theState, t, s);
+	if (ls->version == NULL) return luaL_error(L, "wrx.snapshot() out of memory");
+	ls->slot = &_theState->epochSlot[WRX_EPOCH_SLOT(t)];
+	ls->generation = ls->slot->generation;
+	luaL_setmetatable(L, "wrx.snapshot");
+	return 1;
+}
+
+/*
+	counter = wrx.counter(share or name, key)
+	acc = wrx.accumulator(share or name, key)
+
+	a handle to an integer counter or a float accumulator kept under key, any
+	lua state can update it with get, set, add, max, min and cas without
+	locking the share. share[key] reads it too, and a number assigned to
+	share[key] goes into it
+*/
+int lfwrxCounter(lua_State *L) {
+	return lwrxNewAtomic(L, WRX_FORM_INTEGER);
+}
+
+int lfwrxAccumulator(lua_State *L) {
+	return lwrxNewAtomic(L, WRX_FORM_DOUBLE);
+}
+
+/*
+	id = wrx.subscribe(share or name, func)
+
+	call func(changed, removed) once a frame when the share has changed, with
+	the last value of each changed key and a list of the keys removed. main
+	state only
+*/
+int lfwrxSubscribe(lua_State *L) {
+	lua_Integer id;
+	wrxShare *s;
+	void *h;
+
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		s = wrxGetShare(_theState, lua_tostring(L, 1));
+		if (s == NULL) return luaL_error(L, "%s", wrxGetError(_theState));
+	} else s = lwrxCheckShare(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (lwrxGetThread(L) != NULL) return luaL_error(L, "wrx.subscribe() only works from the main state");
+
+	id = ++wrxSubscriberCount;
+	h = wrxShareSubscribe(_theState, s, lwrxShareChanged, (void*)(intptr_t)id);
+	if (h == NULL) return luaL_error(L, "%s", _theState->error);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxSubscribers);
+	lua_createtable(L, 2, 0);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_pushlightuserdata(L, h);
+	lua_rawseti(L, -2, 2);
+	lua_rawseti(L, -2, id);
+	lua_pop(L, 1);
+	lua_pushinteger(L, id);
+	return 1;
+}
+
+/*
+	ok = wrx.unsubscribe(id)
+
+	stop a wrx.subscribe(), false if it was already stopped
+*/
+int lfwrxUnsubscribe(lua_State *L) {
+	lua_Integer id = luaL_checkinteger(L, 1);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxSubscribers);
+	if (lua_rawgeti(L, -1, id) != LUA_TTABLE) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	lua_rawgeti(L, -1, 2);
+	wrxShareUnsubscribe(_theState, lua_touserdata(L, -1));
+	lua_pushnil(L);
+	lua_rawseti(L, -4, id);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+	future = wrx.job(func, ...)
+
+	run func(...) on a worker thread, arguments and results may be nil,
+	booleans, numbers, strings, tables, blobs or channels
+*/
+int lfwrxJob(lua_State *L) {
+	wrxLuaJob *j;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	if (lua_iscfunction(L, 1)) luaL_argerror(L, 1, "wrx.job() needs a lua function");
+
+	j = lwrxNewJob(L);
+	lua_pushvalue(L, 1);
+	if (lua_dump(L, lwrxCodeWriter, j, 0) != 0) {
+		lwrxFreeJob(j);
+		return luaL_error(L, "wrx.job() could not dump function");
+	}
+	lua_pop(L, 1);
+
+	return lwrxSubmitJob(L, j);
+}
+
+/*
+	future = wrx.spawn(modulePath, ...)
+
+	load a module from the archive and run it on a worker thread, the chunk
+	gets ... as its arguments and whatever it returns comes back through the
+	future. modulePath is a file like "tasks/path.lua", or a module name like
+	"tasks.path"
+*/
+int lfwrxSpawn(lua_State *L) {
+	const char *path = luaL_checkstring(L, 1);
+	wrxLuaJob *j;
+	char name[WRX_LINE];
+	wrxInfo *src;
+	int i;
+
+	src = dwrxReadFile(path);
+	if (src == NULL && strchr(path, '/') == NULL && strlen(path) + 5 < WRX_LINE) {
+		for (i = 0; path[i] != 0; i++) name[i] = (path[i] == '.') ? '/' : path[i];
+		strcpy(name + i, ".lua");
+		path = name;
+		src = dwrxReadFile(path);
+	}
+	if (src == NULL) return luaL_error(L, "wrx.spawn() could not locate %s", lua_tostring(L, 1));
+
+	j = calloc(1, sizeof(wrxLuaJob));
+	if (j == NULL || (j->future = wrxNewFuture()) == NULL) {
+		free(j);
+		dwrxFreeInfo(src);
+		return luaL_error(L, "wrx.spawn() memory allocation failure");
+	}
+	j->source = src;
+	snprintf(j->name, sizeof(j->name), "%s", path);
+	wrxFutureRetain(j->future);
+	lwrxPushFuture(L, j->future);
+
+	return lwrxSubmitJob(L, j);
+}
+
+/*
+	ok = wrx.send(thread, value)
+
+	queue value for a thread, wrx.thread of the receiver or -1 for the main
+	state. returns false if that thread's inbox is full
+*/
+int lfwrxSend(lua_State *L) {
+	wrxThread *t = lwrxGetThread(L);
+	void *inbox = wrxGetInbox(_theState, luaL_checkinteger(L, 1));
+	wrxMessage m;
+
+	if (inbox == NULL) return luaL_argerror(L, 1, "wrx.send() no such thread");
+	if (lwrxToMessage(L, 2, &m) != WRX_OK) return luaL_argerror(L, 2, "wrx.send() can't send this value");
+	m.from = t ? t->id : WRX_MAIN_THREAD;
+	if (wrxInboxPut(inbox, &m)) {
+		lua_pushboolean(L, 1);
+	} else {
+		wrxClearMessage(&m);
+		lua_pushboolean(L, 0);
+	}
+	return 1;
+}
+
+/*
+	from, value = wrx.receive()
+
+	the oldest message sent to this thread, or nil if there is none
+*/
+int lfwrxReceive(lua_State *L) {
+	wrxThread *t = lwrxGetThread(L);
+	void *inbox = t ? t->inbox : _theState->inbox;
+	wrxMessage m;
+
+	if (!wrxInboxGet(inbox, &m)) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushinteger(L, m.from);
+	lwrxPushMessage(L, &m);
+	return 2;
+}
+
+/*
+	... = wrx.await(future)
+
+	the future's results, raising its error if it failed. in a coroutine on
+	the main state this yields until an update finds the future done, on a
+	worker it runs other jobs while it waits
+*/
+int lfwrxAwait(lua_State *L) {
+	wrxFuture *f = lwrxCheckFuture(L, 1);
+
+	lua_settop(L, 1);
+	if (xatomic_load(&f->status) != WRX_FUTURE_PENDING) return lwrxFutureResults(L, f);
+	if (lwrxGetThread(L) != NULL) {
+		wrxFutureWait(_theState, f);
+		return lwrxFutureResults(L, f);
+	}
+	if (!lua_isyieldable(L)) return luaL_error(L, "wrx.await() called outside a coroutine, use future:wait()");
+
+	lwrxSetAwaiting(L, 1);
+	return lua_yieldk(L, 0, 0, lwrxAwaitK);
+}
+
+/*
+	wrx.stage(name, func, after (or nil), worker (or nil))
+
+	add func(dt) to every frame as a stage called name. after is a stage name
+	or a table of them that must finish first, "input" when nil. the engine's
+	stages are "input", "clear" (after input) and "present", which always runs
+	last. a worker stage runs on a worker thread's lua state like a job, so
+	it can overlap the main stages and other worker stages
+*/
+int lfwrxStage(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	int worker = lua_toboolean(L, 4);
+	wrxLuaStage *s;
+	int i, n, flags;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (lwrxGetThread(L) != NULL) return luaL_error(L, "wrx.stage() can only be called from the main state");
+	if (worker && lua_iscfunction(L, 2)) luaL_argerror(L, 2, "wrx.stage() worker stages need a lua function");
+	// check the stages in after up front so a bad one adds nothing
+	lua_settop(L, 3);
+	if (lua_isnil(L, 3)) {
+		lua_pushliteral(L, "input");
+		lua_replace(L, 3);
+	}
+	if (lua_isstring(L, 3)) {
+		lua_newtable(L);
+		lua_pushvalue(L, 3);
+		lua_rawseti(L, -2, 1);
+		lua_replace(L, 3);
+	}
+	luaL_checktype(L, 3, LUA_TTABLE);
+	n = luaL_len(L, 3);
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 3, i);
+		if (!lua_isstring(L, -1)) return luaL_error(L, "wrx.stage() after must hold stage names");
+		flags = wrxStageFlags(_theState, lua_tostring(L, -1));
+		if (flags < 0) return luaL_error(L, "wrx.stage() no stage named %s", lua_tostring(L, -1));
+		if (flags & WRX_STAGE_FINAL) return luaL_error(L, "wrx.stage() nothing can follow %s", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+
+	s = calloc(1, sizeof(wrxLuaStage));
+	if (s == NULL) return luaL_error(L, "wrx.stage() memory allocation failure");
+	snprintf(s->name, sizeof(s->name), "=%s", name);
+	if (worker) {
+		lua_pushvalue(L, 2);
+		if (lua_dump(L, lwrxCodeWriter, &s->job, 0) != 0) {
+			free(s->job.code);
+			free(s);
+			return luaL_error(L, "wrx.stage() could not dump function");
+		}
+		lua_pop(L, 1);
+	}
+	if (wrxAddStage(_theState, name, lwrxRunStage, s, worker ? 0 : WRX_STAGE_MAIN) != WRX_OK) {
+		free(s->job.code);
+		free(s);
+		return luaL_error(L, "%s", _theState->error);
+	}
+	lua_pushvalue(L, 2);
+	s->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 3, i);
+		wrxStageAfter(_theState, name, lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+/*
+	id = wrx.after(ms, func)
+
+	call func(id) once, ms from now. timers run on the main state as part of
+	the frame, so they are only as fine as the frame rate
+*/
+int lfwrxAfter(lua_State *L) {
+	return lwrxAddTimer(L, 0);
+}
+
+/*
+	id = wrx.every(ms, func)
+
+	call func(id) every ms until cancelled, at most once a frame
+*/
+int lfwrxEvery(lua_State *L) {
+	return lwrxAddTimer(L, 1);
+}
+
+/*
+	wrx.cancel(id)
+
+	stop a timer, true if it was still pending. a timer may cancel itself
+*/
+int lfwrxCancel(lua_State *L) {
+	lua_Integer id = luaL_checkinteger(L, 1);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &wrxTimers);
+	if (lua_rawgeti(L, -1, id) != LUA_TTABLE) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	lua_rawgeti(L, -1, 2);
+	wrxCancelTimer(_theState, lua_touserdata(L, -1));
+	lua_pushnil(L);
+	lua_rawseti(L, -4, id);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+	stats = wrx.memory()
+
+	the heap statistics of the calling lua state: bytes, peak, pooled, allocs,
+	frees and the count of strings, tables, functions, userdata and threads
+	created
+*/
+int lfwrxMemory(lua_State *L) {
+	wrxHeapStats s;
+
+	wrxGetHeapStats(L, &s);
+	lua_createtable(L, 0, 10);
+	lua_pushinteger(L, s.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, s.peak);
+	lua_setfield(L, -2, "peak");
+	lua_pushinteger(L, s.pooled);
+	lua_setfield(L, -2, "pooled");
+	lua_pushinteger(L, s.allocs);
+	lua_setfield(L, -2, "allocs");
+	lua_pushinteger(L, s.frees);
+	lua_setfield(L, -2, "frees");
+	lua_pushinteger(L, s.objects[LUA_TSTRING]);
+	lua_setfield(L, -2, "strings");
+	lua_pushinteger(L, s.objects[LUA_TTABLE]);
+	lua_setfield(L, -2, "tables");
+	lua_pushinteger(L, s.objects[LUA_TFUNCTION]);
+	lua_setfield(L, -2, "functions");
+	lua_pushinteger(L, s.objects[LUA_TUSERDATA]);
+	lua_setfield(L, -2, "userdata");
+	lua_pushinteger(L, s.objects[LUA_TTHREAD]);
+	lua_setfield(L, -2, "threads");
+	return 1;
+}
 
+/*
+	wrx.parallel_for(memio, kernel, grain (or nil), ...)
+
+	split memio into ranges of grain bytes and run kernel on each range on the
+	worker threads at once, returning when they have all finished. kernel is
+	a lua function, called as kernel(view, offset, ...) in a worker's lua state
+	where view is a memio over just that range and offset is where the range
+	starts, or the name of a C kernel added with wrxAddKernel(). grain is kept
+	to a multiple of the memio's integer width. read only memios, as handed
+	out by wrx.blob(), are refused
+*/
+int lfwrxParallelFor(lua_State *L) {
+	wrxMemIO *m;
+	wrxLuaRange r;
+	unsigned int width, grain;
+	int i, ret;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_rawgeti(L, 1, 1);
+	m = (wrxMemIO*)lua_topointer(L, -1);
+	lua_pop(L, 1);
+	if (m == NULL || (m->flags & WRX_MEMIO_STREAM)) luaL_argerror(L, 1, "not a memio");
+	// kernels write through their ranges, so a blob's shared bytes are off limits
+	if (m->flags & WRX_MEMIO_READONLY) luaL_argerror(L, 1, "wrx.parallel_for() on a read only memio");
+	grain = luaL_optinteger(L, 3, 0);
+	width = (m->imode >> 3) ? (m->imode >> 3) : 1;
+	if (grain % width) grain += width - grain % width;
+
+	memset(&r, 0, sizeof(wrxLuaRange));
+	r.imode = m->imode;
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		r.kernel = wrxGetKernel(lua_tostring(L, 2));
+		if (r.kernel == NULL) return luaL_error(L, "wrx.parallel_for() no kernel named %s", lua_tostring(L, 2));
+	} else {
+		luaL_checktype(L, 2, LUA_TFUNCTION);
+		if (lua_iscfunction(L, 2)) luaL_argerror(L, 2, "wrx.parallel_for() needs a lua function or a kernel name");
+		lua_pushvalue(L, 2);
+		ret = lua_dump(L, lwrxCodeWriter, &r.job, 0);
+		lua_pop(L, 1);
+		if (ret != 0) {
+			free(r.job.code);
+			return luaL_error(L, "wrx.parallel_for() could not dump function");
+		}
+	}
+
+	r.job.nargs = (lua_gettop(L) > 3) ? lua_gettop(L) - 3 : 0;
+	r.job.args = calloc(r.job.nargs, sizeof(wrxInfo));
+	for (i = 0; i < r.job.nargs; i++) {
+		if (r.job.args == NULL || lwrxToInfo(L, i + 4, &r.job.args[i]) != WRX_OK) break;
+	}
+	if (i == r.job.nargs) {
+		ret = wrxParallelFor(_theState, m->mem, m->length, grain, lwrxRunRange, &r);
+		if (ret != WRX_OK) snprintf(r.error, WRX_LINE, "wrx.parallel_for() no worker threads are running");
+	} else {
+		snprintf(r.error, WRX_LINE, "wrx.parallel_for() can't move argument %d to a worker", i + 4);
+		ret = WRX_ERR;
+	}
+
+	while (i-- > 0) dwrxClearInfo(&r.job.args[i]);
+	free(r.job.args);
+	free(r.job.code);
+	if (ret != WRX_OK || r.failed) return luaL_error(L, "%s", r.error);
+	return 0;
+}
+
+/*
+	future = wrx.load(filename, mimetype (or nil))
+
+	read a file from the archive on a worker, the future resolves to the
+	contents as a string and the mime type, guessed from the extension if
+	none is given
+*/
+int lfwrxLoad(lua_State *L) {
+	const char *name = luaL_checkstring(L, 1);
+	const char *mime = luaL_optstring(L, 2, NULL);
+	wrxLoad *ld;
+
+	if (mime == NULL) mime = lwrxMimeType(name);
+	ld = calloc(1, sizeof(wrxLoad));
+	if (ld == NULL || (ld->future = wrxNewFuture()) == NULL) {
+		free(ld);
+		return luaL_error(L, "wrx.load() memory allocation failure");
+	}
+	strncpy(ld->name, name, WRX_LINE - 1);
+	snprintf(ld->mime, sizeof(ld->mime), "%s", mime);
+	wrxFutureRetain(ld->future);
+	lwrxPushFuture(L, ld->future);
+
+	if (wrxJobSubmitTo(_theState, WRX_POOL_IO, lwrxRunLoad, ld) != WRX_OK) {
+		wrxFutureRelease(ld->future);
+		free(ld);
+		return luaL_error(L, "wrx.load() no worker threads are running");
+	}
+	return 1;
 }
 
 
@@ -221,8 +1923,8 @@ int lfwrxmiGet(lua_State *L);
 int lfwrxmiPut(lua_State *L);
 int lfwrxmiSet(lua_State *L);
 
-int lfwrxPushIO(lua_State *L, void *mem, unsigned long bytes, unsigned int local) {
-    lua_newtable(L);
+// the memio methods, for the table on top of the stack
+void lwrxSetIOMethods(lua_State *L) {
     lua_pushcfunction(L, lfwrxmiLines);
     lua_setfield(L, -2, "lines");
     lua_pushcfunction(L, lfwrxmiRead);
@@ -241,6 +1943,11 @@ int lfwrxPushIO(lua_State *L, void *mem, unsigned long bytes, unsigned int local
     lua_setfield(L, -2, "put");
     lua_pushcfunction(L, lfwrxmiSet);
     lua_setfield(L, -2, "set");
+}
+
+int lfwrxPushIO(lua_State *L, void *mem, unsigned long bytes, unsigned int local) {
+    lua_newtable(L);
+    lwrxSetIOMethods(L);
     wrxMemIO *p = calloc(1, sizeof(wrxMemIO));
     p->mem = mem;
     p->length = bytes;
@@ -251,6 +1958,246 @@ int lfwrxPushIO(lua_State *L, void *mem, unsigned long bytes, unsigned int local
     return 1;
 }
 
+// a memio over memory owned elsewhere, collected with the table so it suits
+// short lived views like the ranges in wrx.parallel_for()
+int lfwrxPushView(lua_State *L, void *mem, unsigned long bytes, unsigned int imode) {
+    lua_newtable(L);
+    lwrxSetIOMethods(L);
+    wrxMemIO *p = lua_newuserdatauv(L, sizeof(wrxMemIO), 0);
+    memset(p, 0, sizeof(wrxMemIO));
+    p->mem = mem;
+    p->length = bytes;
+    p->imode = imode;
+    lua_rawseti(L, -2, 1);
+    return 1;
+}
+
+typedef struct {
+    wrxMemIO io;
+    wrxBlob *blob;
+} wrxBlobView;
+
+// a read only memio over a blob, it takes over one of the caller's references
+int lfwrxPushBlob(lua_State *L, wrxBlob *b) {
+    wrxBlobView *v;
+
+    lua_newtable(L);
+    lwrxSetIOMethods(L);
+    v = lua_newuserdatauv(L, sizeof(wrxBlobView), 0);
+    memset(v, 0, sizeof(wrxBlobView));
+    v->io.mem = b->mem;
+    v->io.length = b->length;
+    v->io.imode = 8;
+    v->io.flags = WRX_MEMIO_READONLY;
+    v->blob = b;
+    luaL_setmetatable(L, "wrx.blob");
+    lua_rawseti(L, -2, 1);
+    return 1;
+}
+
+// the blob behind the memio at index, or NULL when it isn't a blob's
+wrxBlob *lwrxToBlob(lua_State *L, int index) {
+    wrxBlobView *v = NULL;
+
+    if (lua_type(L, index) != LUA_TTABLE) return NULL;
+    lua_rawgeti(L, index, 1);
+    v = luaL_testudata(L, -1, "wrx.blob");
+    lua_pop(L, 1);
+    return (v != NULL) ? v->blob : NULL;
+}
+
+int lfwrxBlobGc(lua_State *L) {
+    wrxBlobView *v = luaL_checkudata(L, 1, "wrx.blob");
+
+    dwrxReleaseBlob(v->blob);
+    v->blob = NULL;
+    return 0;
+}
+
+/*
+    memio = wrx.blob(string or memio)
+
+    copy the bytes once into an immutable blob and return a read only memio
+    over it. the memio can be sent, shared or handed to jobs, and every lua
+    state reading it sees the same memory
+*/
+int lfwrxBlob(lua_State *L) {
+    const char *s;
+    wrxMemIO *m;
+    wrxBlob *b;
+    size_t len;
+
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        s = lua_tolstring(L, 1, &len);
+        if (len > 0xFFFFFFF0) luaL_argerror(L, 1, "wrx.blob() string too long");
+        b = dwrxNewBlob(s, len);
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        // already a blob, so just another reference
+        if ((b = lwrxToBlob(L, 1)) != NULL) {
+            dwrxRetainBlob(b);
+            return lfwrxPushBlob(L, b);
+        }
+        lua_rawgeti(L, 1, 1);
+        m = (wrxMemIO*)lua_topointer(L, -1);
+        lua_pop(L, 1);
+        if (m == NULL || (m->flags & WRX_MEMIO_STREAM)) luaL_argerror(L, 1, "wrx.blob() needs a string or a memio");
+        b = dwrxNewBlob(m->mem, m->length);
+    }
+    if (b == NULL) return luaL_error(L, "wrx.blob() memory allocation failure");
+    return lfwrxPushBlob(L, b);
+}
+
+typedef struct {
+    wrxMemIO io;
+    wrxChannel *chan;
+} wrxChannelView;
+
+// a memio over one end of a channel, it takes over one of the caller's references
+int lfwrxPushChannel(lua_State *L, wrxChannel *c, int end) {
+    wrxChannelView *v;
+
+    lua_newtable(L);
+    lwrxSetIOMethods(L);
+    v = lua_newuserdatauv(L, sizeof(wrxChannelView), 0);
+    memset(v, 0, sizeof(wrxChannelView));
+    v->io.length = c->capacity;
+    v->io.imode = 8;
+    v->io.flags = end;
+    v->chan = c;
+    luaL_setmetatable(L, "wrx.channel");
+    lua_rawseti(L, -2, 1);
+    return 1;
+}
+
+// the channel behind the memio at index and which end it is, or NULL
+wrxChannel *lwrxToChannel(lua_State *L, int index, int *end) {
+    wrxChannelView *v = NULL;
+
+    if (lua_type(L, index) != LUA_TTABLE) return NULL;
+    lua_rawgeti(L, index, 1);
+    v = luaL_testudata(L, -1, "wrx.channel");
+    lua_pop(L, 1);
+    if (v == NULL) return NULL;
+    *end = v->io.flags & WRX_MEMIO_STREAM;
+    return v->chan;
+}
+
+int lfwrxChannelGc(lua_State *L) {
+    wrxChannelView *v = luaL_checkudata(L, 1, "wrx.channel");
+
+    wrxReleaseChannel(v->chan);
+    v->chan = NULL;
+    return 0;
+}
+
+/*
+    writer, reader = wrx.channel(bytes)
+
+    a fixed ring of at least bytes streaming from one lua state to another,
+    both ends are memios that can be sent or handed to jobs. the writer only
+    puts and the reader only gets, neither ever blocks: put reports what
+    fit and get returns nil once nothing is waiting. keep to one writer and
+    one reader at a time
+*/
+int lfwrxChannel(lua_State *L) {
+    lua_Integer bytes = luaL_checkinteger(L, 1);
+    wrxChannel *c;
+
+    if (bytes < 1 || bytes > (1 << 30)) luaL_argerror(L, 1, "wrx.channel() size out of range");
+    c = wrxNewChannel(bytes);
+    if (c == NULL) return luaL_error(L, "wrx.channel() memory allocation failure");
+    wrxRetainChannel(c);
+    lfwrxPushChannel(L, c, WRX_MEMIO_WRITER);
+    lfwrxPushChannel(L, c, WRX_MEMIO_READER);
+    return 2;
+}
+
+// memio:get() on a channel's reader, whole values only and never more than are waiting
+int lwrxStreamGet(lua_State *L, wrxMemIO *m) {
+    wrxChannel *c = ((wrxChannelView*)m)->chan;
+    unsigned int b = m->imode >> 3, avail, n, i, cb, k = 0;
+    unsigned char buf[512];
+    unsigned long long v;
+    int t = lua_gettop(L), func;
+
+    if (!(m->flags & WRX_MEMIO_READER)) luaL_error(L, "memio:get() on the writing end of a channel");
+    if (t == 1) {
+        if (wrxChannelRead(c, buf, b) != WRX_OK) {
+            lua_pushnil(L);
+            return 1;
+        }
+        for (v = 0, cb = b; cb-- > 0;) v = (v << 8) | buf[cb];
+        lua_pushinteger(L, v);
+        return 1;
+    }
+    if (t != 4) luaL_error(L, "memio:get() improperly formatted call");
+    func = lua_isfunction(L, 2);
+    if (!func && !lua_istable(L, 2)) luaL_error(L, "memio:get(,,) improperly formatted call");
+    n = func ? luaL_checkinteger(L, 4) : luaL_checkinteger(L, 4) - luaL_checkinteger(L, 3) + 1;
+    avail = wrxChannelUsed(c) / b;
+    if ((int)n < 0) n = 0;
+    if (n > avail) n = avail;
+    // pull the values out a buffer at a time, the reader is the only one taking
+    while (k < n) {
+        unsigned int chunk = n - k;
+        if (chunk > sizeof(buf) / b) chunk = sizeof(buf) / b;
+        wrxChannelRead(c, buf, chunk * b);
+        for (i = 0; i < chunk; i++, k++) {
+            for (v = 0, cb = b; cb-- > 0;) v = (v << 8) | buf[i * b + cb];
+            if (func) {
+                lua_pushvalue(L, 2);
+                lua_pushvalue(L, 1);
+                lua_pushinteger(L, v);
+                lua_pushvalue(L, 3);
+                lua_pushinteger(L, k + 1);
+                lua_call(L, 4, 0);
+            } else {
+                lua_pushinteger(L, v);
+                lua_rawseti(L, 2, lua_tointeger(L, 3) + k);
+            }
+        }
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+// memio:put() on a channel's writer, whole values only and never more than fit
+int lwrxStreamPut(lua_State *L, wrxMemIO *m) {
+    wrxChannel *c = ((wrxChannelView*)m)->chan;
+    unsigned int b = m->imode >> 3, room, n, i, cb, k = 0;
+    unsigned char buf[512];
+    unsigned long long v;
+    lua_Integer s;
+
+    if (!(m->flags & WRX_MEMIO_WRITER)) luaL_error(L, "memio:put() on the reading end of a channel");
+    if (lua_istable(L, 2)) {
+        s = luaL_checkinteger(L, 3);
+        n = luaL_checkinteger(L, 4) - s + 1;
+        room = wrxChannelRoom(c) / b;
+        if ((int)n < 0) n = 0;
+        if (n > room) n = room;
+        // the writer is the only one filling, so the room can only grow
+        while (k < n) {
+            unsigned int chunk = n - k;
+            if (chunk > sizeof(buf) / b) chunk = sizeof(buf) / b;
+            for (i = 0; i < chunk; i++) {
+                lua_rawgeti(L, 2, s + k + i);
+                v = luaL_checkinteger(L, -1);
+                lua_pop(L, 1);
+                for (cb = 0; cb < b; cb++) buf[i * b + cb] = (v >> (cb * 8)) & 0xFF;
+            }
+            wrxChannelWrite(c, buf, chunk * b);
+            k += chunk;
+        }
+        lua_pushinteger(L, n);
+        return 1;
+    }
+    v = luaL_checkinteger(L, 2);
+    for (cb = 0; cb < b; cb++) buf[cb] = (v >> (cb * 8)) & 0xFF;
+    lua_pushboolean(L, wrxChannelWrite(c, buf, b) == WRX_OK);
+    return 1;
+}
 
 int lfwrxmiLineReaderFunc(lua_State *L) {
     lua_pushvalue(L, lua_upvalueindex(1));
@@ -304,6 +2251,7 @@ int lfwrxmiLineReaderFunc(lua_State *L) {
 */
 int lfwrxmiLines(lua_State *L) {
     lua_rawgeti(L, 1, 1);
+    if (((wrxMemIO*)lua_topointer(L, -1))->flags & WRX_MEMIO_STREAM) luaL_error(L, "memio:lines() on a channel");
     lua_pushcclosure(L, lfwrxmiLineReaderFunc, 1);
     return 1;
 }
@@ -330,6 +2278,7 @@ int lfwrxmiSeek(lua_State *L) {
     lua_rawgeti(L, 1, 1);
     wrxMemIO *m = (wrxMemIO*)lua_topointer(L, -1);
     lua_pop(L,1);
+    if (m->flags & WRX_MEMIO_STREAM) luaL_error(L, "memio:seek() on a channel");
     const char *w = luaL_checkstring(L, 2);
     int offset = 0;
     if (lua_isnumber(L, 3)) offset = lua_tointeger(L, 3);
@@ -375,7 +2324,8 @@ int lfwrxmiCopy(lua_State *L) {
     lua_rawgeti(L, 1, 1);
     wrxMemIO *m = (wrxMemIO*)lua_topointer(L, -1);
     lua_pop(L,1);
-    
+    if (m->flags & WRX_MEMIO_STREAM) luaL_error(L, "memio:copy() on a channel");
+
     if (t == 1) {
         unsigned char *n = malloc(m->length);
         if (n == NULL) luaL_error(L, "memio:copy() memory allocation failure");
@@ -405,6 +2355,9 @@ int lfwrxmiCopy(lua_State *L) {
         "t" = total bytes
         "r" = remaining bytes
         "i" = integer bit width
+
+    on a channel "p" is the bytes that end has moved so far, "t" the ring's
+    size and "r" what the reader could get or the writer could put right now
 */
 int lfwrxmiTell(lua_State *L) {
     if (!luaL_checkstring(L, 2)) luaL_error(L, "memio:tell() takes a string parameter");
@@ -412,6 +2365,18 @@ int lfwrxmiTell(lua_State *L) {
     wrxMemIO *m = (wrxMemIO*)lua_topointer(L, -1);
     lua_pop(L,1);
     const char *s = lua_tostring(L,2);
+    if (m->flags & WRX_MEMIO_STREAM) {
+        wrxChannel *c = ((wrxChannelView*)m)->chan;
+        int reader = m->flags & WRX_MEMIO_READER;
+        switch (s[0]) {
+            case 'p':
+                lua_pushinteger(L, xatomic_load(reader ? &c->tail : &c->head));
+                return 1;
+            case 'r':
+                lua_pushinteger(L, reader ? wrxChannelUsed(c) : wrxChannelRoom(c));
+                return 1;
+        }
+    }
     switch (s[0]) {
         case 'p': 
             lua_pushinteger(L, m->pos);
@@ -459,6 +2424,7 @@ int lfwrxmiGet(lua_State *L) {
     unsigned int b = m->imode >> 3;
     unsigned long long v = 0, mul = 1;
 
+    if (m->flags & WRX_MEMIO_STREAM) return lwrxStreamGet(L, m);
     if (t == 1) {
         while (b-- > 0) {
             if (m->pos < m->length) {
@@ -533,6 +2499,8 @@ int lfwrxmiPut(lua_State *L) {
     wrxMemIO *m = (wrxMemIO*)lua_topointer(L, -1);
     lua_pop(L,1);
     b = m->imode >> 3;
+    if (m->flags & WRX_MEMIO_STREAM) return lwrxStreamPut(L, m);
+    if (m->flags & WRX_MEMIO_READONLY) luaL_error(L, "memio:put() on a read only memio");
 
     if (luaL_checkinteger(L, 2)) {
         v = lua_tointeger(L, 2);
@@ -578,6 +2546,7 @@ int lfwrxmiSet(lua_State *L) {
     lua_pop(L,1);
     switch (s[0]) {
         case 'p': 
+            if (m->flags & WRX_MEMIO_STREAM) luaL_error(L, "memio:set('p',) on a channel");
             if (v > m->length) luaL_error(L, "memio:set() tried to set position passed end of memory block");
             if (v < 0) luaL_error(L, "memio:set() tried to set position before the start of memory block");
             m->pos = v;
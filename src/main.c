@@ -32,6 +32,12 @@ int main(int argc, char *argv[])
         }
     }
 
+    wrxJobStop(ps);
+    wrxFreeFrame(ps);
+    wrxFreeTimers(ps);
+    wrxFreeShares(ps);
+    dwrxFreeSharedTable(ps->gTable);
+    for (int i = 0; i < 256; i++) dwrxFreeTree(ps->gTree[i]);
     dwrxStop();
 
     return 0;
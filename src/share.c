@@ -0,0 +1,726 @@
+/*
+	wrx-engine: shared tables
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <string.h>
+
+// a share is split into WRX_SHARE_SHARDS shards by the top bits of the key's
+// hash, each with its own lock and chained buckets, so threads working on
+// different keys rarely wait on each other. shares live until wrxFreeShares()
+#define WRX_SHARE_SHIFT		(32 - WRX_SHARE_BITS)
+#define WRX_SHARE_BUCKETS	16			// starting buckets per shard, a power of 2
+
+typedef struct wrxShareEntry {
+	struct wrxShareEntry *next;
+	unsigned int hash;
+	const char *key;					// interned and held, v.name holds a copy
+	wrxInfo v;
+} wrxShareEntry;
+
+// coalesces a frame's writes, slot holds an index into push.entry plus one and
+// there are always twice as many slots as entries fit
+typedef struct {
+	int capacity;						// slots, a power of 2
+	int slot[];
+} wrxPushIndex;
+
+typedef struct wrxShareSub {
+	struct wrxShareSub *next;
+	wrxShare *share;
+	wrxShareFunc func;					// NULL once unsubscribed
+	void *arg;
+} wrxShareSub;
+
+// a frozen copy of a share, an open addressed table nothing writes to once it
+// is published. WRX_FORM_NULL marks an empty slot
+typedef struct wrxShareVersion {
+	struct wrxShareVersion *next;		// on the retired list
+	unsigned long long retired;			// the epoch it was replaced in
+	int capacity;						// a power of 2
+	wrxShareEntry entry[];
+} wrxShareVersion;
+
+// copy src into dst, data and tables get their own memory, blobs and
+// channels another reference and atomics become their current value
+static int wrxShareCopy(wrxInfo *dst, const wrxInfo *src) {
+	memcpy(dst, src, sizeof(wrxInfo));
+	if (src->form == WRX_FORM_DATA || src->form == WRX_FORM_TABLE) {
+		dst->data.memory = malloc(src->data.bytes);
+		if (dst->data.memory == NULL) {
+			dst->form = WRX_FORM_NULL;
+			return WRX_ERR;
+		}
+		memcpy(dst->data.memory, src->data.memory, src->data.bytes);
+	} else if (src->form == WRX_FORM_BLOB) {
+		dwrxRetainBlob(src->p);
+	} else if (src->form == WRX_FORM_CHANNEL) {
+		wrxRetainChannel(src->p);
+	} else if (src->form == WRX_FORM_ATOMIC) {
+		// readers get the number it holds right now
+		wrxAtomicLoad(src->p, dst);
+	}
+	return WRX_OK;
+}
+
+static wrxShareShard *wrxShareShardFor(wrxShare *s, unsigned int hash) {
+	return &s->shard[hash >> WRX_SHARE_SHIFT];
+}
+
+// the entry for key, an interned name, or NULL. the shard must be locked
+static wrxShareEntry **wrxShareFind(wrxShareShard *d, const char *key, unsigned int hash) {
+	wrxShareEntry **e;
+
+	if (d->bucket == NULL) return NULL;
+	for (e = (wrxShareEntry**)&d->bucket[hash & (d->capacity - 1)]; *e != NULL; e = &(*e)->next) {
+		if ((*e)->key == key) return e;
+	}
+	return NULL;
+}
+
+// double the buckets once a shard averages more than one entry per bucket
+static int wrxShareGrow(wrxShareShard *d) {
+	int capacity = d->capacity ? d->capacity * 2 : WRX_SHARE_BUCKETS;
+	void **bucket = calloc(capacity, sizeof(void*));
+	wrxShareEntry *e, *n;
+
+	if (bucket == NULL) return WRX_ERR;
+	for (int i = 0; i < d->capacity; i++) {
+		for (e = d->bucket[i]; e != NULL; e = n) {
+			n = e->next;
+			e->next = bucket[e->hash & (capacity - 1)];
+			bucket[e->hash & (capacity - 1)] = e;
+		}
+	}
+	free(d->bucket);
+	d->bucket = bucket;
+	d->capacity = capacity;
+	return WRX_OK;
+}
+
+static wrxShare *wrxNewShare(const char *name) {
+	wrxShare *s = calloc(1, sizeof(wrxShare));
+
+	if (s == NULL) return NULL;
+	strncpy(s->shareName.name, name, sizeof(s->shareName.name) - 1);
+	s->shareName.form = WRX_FORM_NULL;
+	for (int i = 0; i < WRX_SHARE_SHARDS; i++) pthread_mutex_init(&s->shard[i].lock, NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	return s;
+}
+
+static void wrxFreeVersion(wrxShareVersion *v) {
+	if (v == NULL) return;
+	for (int i = 0; i < v->capacity; i++) {
+		if (v->entry[i].key != NULL) dwrxNameRelease(v->entry[i].key);
+		dwrxClearInfo(&v->entry[i].v);
+	}
+	free(v);
+}
+
+static void wrxFreePush(wrxInfoTable *push) {
+	for (int i = 0; i < push->length; i++) dwrxClearInfo(&push->entry[i]);
+	free(push->entry);
+	free(push->nindex);
+	memset(push, 0, sizeof(wrxInfoTable));
+}
+
+static void wrxFreeShare(wrxShare *s) {
+	wrxShareEntry *e, *n;
+	wrxShareAtomic *a;
+	wrxShareSub *sub;
+
+	for (int i = 0; i < WRX_SHARE_SHARDS; i++) {
+		for (int b = 0; b < s->shard[i].capacity; b++) {
+			for (e = s->shard[i].bucket[b]; e != NULL; e = n) {
+				n = e->next;
+				dwrxNameRelease(e->key);
+				dwrxClearInfo(&e->v);
+				free(e);
+			}
+		}
+		free(s->shard[i].bucket);
+		pthread_mutex_destroy(&s->shard[i].lock);
+	}
+	wrxFreeVersion(s->version);
+	wrxFreePush(&s->push);
+	while ((sub = s->subscriber) != NULL) {
+		s->subscriber = sub->next;
+		free(sub);
+	}
+	while ((a = s->atomics) != NULL) {
+		s->atomics = a->next;
+		free(a);
+	}
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+// the share called name, made on first use. every thread asking for the same
+// name gets the same share
+wrxShare *wrxGetShare(wrxState *p, const char *name) {
+	wrxShare *s;
+
+	if (strlen(name) >= sizeof(s->shareName.name)) {
+		wrxError(p, "wrxGetShare() share name too long: %s", name);
+		return NULL;
+	}
+	pthread_mutex_lock(&p->tableLock);
+	for (s = p->shares; s != NULL; s = s->next) {
+		if (!strcmp(s->shareName.name, name)) break;
+	}
+	if (s == NULL && (s = wrxNewShare(name)) != NULL) {
+		s->next = p->shares;
+		p->shares = s;
+	}
+	pthread_mutex_unlock(&p->tableLock);
+	if (s == NULL) wrxError(p, "wrxGetShare() out of memory");
+	return s;
+}
+
+// copy the value under key into v, WRX_NOPE when there is none. data is
+// copied too, so release v with dwrxClearInfo()
+int wrxShareGet(wrxShare *s, const char *key, wrxInfo *v) {
+	wrxShareShard *d;
+	wrxShareEntry **e;
+	unsigned int hash;
+	int ret = WRX_NOPE;
+
+	// keys are interned when set, so a name that never was isn't here
+	if ((key = dwrxInterned(key)) == NULL) return WRX_NOPE;
+	hash = dwrxNameHash(key);
+	d = wrxShareShardFor(s, hash);
+	pthread_mutex_lock(&d->lock);
+	if ((e = wrxShareFind(d, key, hash)) != NULL) ret = wrxShareCopy(v, &(*e)->v);
+	pthread_mutex_unlock(&d->lock);
+	return ret;
+}
+
+// remember v as key's latest change, replacing one from earlier in the frame.
+// takes over v, and hands back what it replaced in old
+static int wrxSharePush(wrxShare *s, unsigned int hash, wrxInfo *v, wrxInfo *old) {
+	wrxInfoTable *push = &s->push;
+	wrxPushIndex *x = push->nindex, *nx;
+	wrxInfo *entry;
+	int i, j, capacity;
+
+	pthread_mutex_lock(&s->lock);
+	for (i = (x != NULL) ? hash & (x->capacity - 1) : 0; x != NULL && x->slot[i] != 0; i = (i + 1) & (x->capacity - 1)) {
+		if (!strcmp(push->entry[x->slot[i] - 1].name, v->name)) {
+			memcpy(old, &push->entry[x->slot[i] - 1], sizeof(wrxInfo));
+			memcpy(&push->entry[x->slot[i] - 1], v, sizeof(wrxInfo));
+			pthread_mutex_unlock(&s->lock);
+			return WRX_OK;
+		}
+	}
+	if (x == NULL || push->length >= x->capacity / 2) {
+		// grow both, and put every entry back in the bigger index
+		capacity = (x != NULL) ? x->capacity * 2 : 32;
+		entry = realloc(push->entry, (capacity / 2) * sizeof(wrxInfo));
+		if (entry != NULL) push->entry = entry;
+		nx = calloc(1, sizeof(wrxPushIndex) + capacity * sizeof(int));
+		if (entry == NULL || nx == NULL) {
+			free(nx);
+			pthread_mutex_unlock(&s->lock);
+			memcpy(old, v, sizeof(wrxInfo));
+			return WRX_ERR;
+		}
+		nx->capacity = capacity;
+		for (j = 0; j < push->length; j++) {
+			for (i = dwrxStringHash(push->entry[j].name) & (capacity - 1); nx->slot[i] != 0; i = (i + 1) & (capacity - 1));
+			nx->slot[i] = j + 1;
+		}
+		free(x);
+		push->nindex = x = nx;
+		for (i = hash & (capacity - 1); x->slot[i] != 0; i = (i + 1) & (capacity - 1));
+	}
+	memcpy(&push->entry[push->length], v, sizeof(wrxInfo));
+	x->slot[i] = ++push->length;
+	pthread_mutex_unlock(&s->lock);
+	return WRX_OK;
+}
+
+// store v under key, taking over anything v owns. a WRX_FORM_NULL value
+// removes the key
+int wrxShareSet(wrxShare *s, const char *key, wrxInfo *v) {
+	wrxShareEntry **e, *gone = NULL, *n;
+	wrxInfo old, change, replaced;
+	wrxShareShard *d;
+	unsigned int hash;
+	int ret = WRX_OK, relay;
+
+	if (strlen(key) >= sizeof(v->name) || (key = dwrxIntern(key)) == NULL) {
+		dwrxClearInfo(v);
+		return WRX_ERR;
+	}
+	hash = dwrxNameHash(key);
+	d = wrxShareShardFor(s, hash);
+	old.form = change.form = replaced.form = WRX_FORM_NULL;
+	// the relay needs its own copy, made before we take the lock
+	relay = xatomic_load(&s->subscribers) > 0;
+	if (relay && wrxShareCopy(&change, v) != WRX_OK) relay = 0;
+	strcpy(change.name, key);
+
+	pthread_mutex_lock(&d->lock);
+	if ((e = wrxShareFind(d, key, hash)) != NULL) {
+		memcpy(&old, &(*e)->v, sizeof(wrxInfo));
+		xatomic_store_relaxed(&s->dirty, 1);
+		if (old.form == WRX_FORM_ATOMIC && wrxAtomicUpdate(old.p, WRX_ATOMIC_SET, v) == WRX_OK) {
+			// a number that fits stays in the atomic, so handles to it keep working
+			old.form = WRX_FORM_NULL;
+		} else if (old.form == WRX_FORM_ATOMIC) {
+			xatomic_store(&((wrxShareAtomic*)old.p)->live, 0);
+		}
+		if (old.form == WRX_FORM_NULL) {
+			// already stored
+		} else if (v->form == WRX_FORM_NULL) {
+			gone = *e;
+			*e = gone->next;
+			d->count--;
+		} else {
+			memcpy(&(*e)->v, v, sizeof(wrxInfo));
+			strcpy((*e)->v.name, key);
+		}
+	} else if (v->form != WRX_FORM_NULL) {
+		if ((d->count < d->capacity || wrxShareGrow(d) == WRX_OK) && (n = malloc(sizeof(wrxShareEntry))) != NULL) {
+			memcpy(&n->v, v, sizeof(wrxInfo));
+			strcpy(n->v.name, key);
+			n->hash = hash;
+			n->key = key;
+			dwrxNameRetain(key);
+			n->next = d->bucket[hash & (d->capacity - 1)];
+			d->bucket[hash & (d->capacity - 1)] = n;
+			d->count++;
+			xatomic_store_relaxed(&s->dirty, 1);
+		} else {
+			// out of memory, v is dropped
+			memcpy(&old, v, sizeof(wrxInfo));
+			ret = WRX_ERR;
+		}
+	} else relay = 0;
+	// pushed while the shard is locked, so the relay sees a key's writes in the order the share did
+	if (relay && ret == WRX_OK) wrxSharePush(s, hash, &change, &replaced);
+		else memcpy(&replaced, &change, sizeof(wrxInfo));
+	pthread_mutex_unlock(&d->lock);
+
+	// release what was replaced once other threads can get at the shard again
+	if (gone != NULL) dwrxNameRelease(gone->key);
+	free(gone);
+	dwrxClearInfo(&old);
+	dwrxClearInfo(&replaced);
+	dwrxNameRelease(key);
+	return ret;
+}
+
+// *****************************************************************************
+// atomics, numbers threads update with fetch-add or compare-exchange instead of
+// the shard locks
+
+static double wrxAtomicDouble(long long bits) {
+	double d;
+
+	memcpy(&d, &bits, sizeof(double));
+	return d;
+}
+
+static long long wrxAtomicBits(double d) {
+	long long bits;
+
+	memcpy(&bits, &d, sizeof(double));
+	return bits;
+}
+
+// v as a's form, WRX_NOPE when it doesn't fit. integers go into doubles but
+// not the other way around
+static int wrxAtomicArg(wrxShareAtomic *a, const wrxInfo *v, long long *bits) {
+	if (a->form == WRX_FORM_INTEGER && v->form == WRX_FORM_INTEGER) *bits = v->l[0];
+		else if (a->form == WRX_FORM_DOUBLE && v->form == WRX_FORM_DOUBLE) *bits = wrxAtomicBits(v->d[0]);
+		else if (a->form == WRX_FORM_DOUBLE && v->form == WRX_FORM_INTEGER) *bits = wrxAtomicBits((double)v->l[0]);
+		else return WRX_NOPE;
+	return WRX_OK;
+}
+
+static void wrxAtomicTouch(wrxShareAtomic *a) {
+	// look first, so a hot counter doesn't keep writing these cache lines
+	if (!xatomic_load_relaxed(&a->changed)) xatomic_store(&a->changed, 1);
+	if (!xatomic_load_relaxed(&a->share->dirty)) xatomic_store(&a->share->dirty, 1);
+}
+
+void wrxAtomicLoad(wrxShareAtomic *a, wrxInfo *v) {
+	long long bits = xatomic_load(&a->value);
+
+	v->form = a->form;
+	if (a->form == WRX_FORM_INTEGER) v->l[0] = bits;
+		else v->d[0] = wrxAtomicDouble(bits);
+}
+
+// apply op with v to a, v is left holding a's new value. WRX_NOPE when v isn't
+// a number a can take
+int wrxAtomicUpdate(wrxShareAtomic *a, int op, wrxInfo *v) {
+	long long arg, cur, next;
+
+	if (wrxAtomicArg(a, v, &arg) != WRX_OK) return WRX_NOPE;
+	if (op == WRX_ATOMIC_SET) {
+		xatomic_store(&a->value, arg);
+	} else if (op == WRX_ATOMIC_ADD && a->form == WRX_FORM_INTEGER) {
+		xatomic_add(&a->value, arg);
+	} else {
+		cur = xatomic_load(&a->value);
+		do {
+			if (a->form == WRX_FORM_INTEGER) {
+				next = (op == WRX_ATOMIC_MAX) ? (arg > cur ? arg : cur) : (arg < cur ? arg : cur);
+			} else if (op == WRX_ATOMIC_ADD) {
+				next = wrxAtomicBits(wrxAtomicDouble(cur) + wrxAtomicDouble(arg));
+			} else {
+				double c = wrxAtomicDouble(cur), g = wrxAtomicDouble(arg);
+				next = ((op == WRX_ATOMIC_MAX) ? (g > c) : (g < c)) ? arg : cur;
+			}
+			// a reducer that wouldn't change anything doesn't write
+			if (next == cur) break;
+		} while (!xatomic_cas(&a->value, &cur, next));
+	}
+	wrxAtomicTouch(a);
+	wrxAtomicLoad(a, v);
+	return WRX_OK;
+}
+
+// set a to v if it holds expect. either way expect is left holding what a held
+int wrxAtomicCas(wrxShareAtomic *a, wrxInfo *expect, wrxInfo *v) {
+	long long cur, next;
+	int ret;
+
+	if (wrxAtomicArg(a, expect, &cur) != WRX_OK || wrxAtomicArg(a, v, &next) != WRX_OK) return WRX_ERR;
+	ret = xatomic_cas(&a->value, &cur, next) ? WRX_OK : WRX_NOPE;
+	if (ret == WRX_OK) wrxAtomicTouch(a);
+	expect->form = a->form;
+	if (a->form == WRX_FORM_INTEGER) expect->l[0] = cur;
+		else expect->d[0] = wrxAtomicDouble(cur);
+	return ret;
+}
+
+// the atomic under key, form is WRX_FORM_INTEGER for a counter or
+// WRX_FORM_DOUBLE for an accumulator. a number already under key is its
+// starting value. NULL when key holds the other kind or we are out of memory
+wrxShareAtomic *wrxShareGetAtomic(wrxShare *s, const char *key, int form) {
+	wrxShareAtomic *a = NULL;
+	wrxShareEntry **e, *n = NULL;
+	wrxShareShard *d;
+	unsigned int hash;
+	wrxInfo old;
+
+	if (strlen(key) >= sizeof(old.name) || (key = dwrxIntern(key)) == NULL) return NULL;
+	hash = dwrxNameHash(key);
+	d = wrxShareShardFor(s, hash);
+	old.form = WRX_FORM_NULL;
+	pthread_mutex_lock(&d->lock);
+	e = wrxShareFind(d, key, hash);
+	if (e != NULL && (*e)->v.form == WRX_FORM_ATOMIC) {
+		a = (*e)->v.p;
+		if (a->form != form) a = NULL;
+		pthread_mutex_unlock(&d->lock);
+		dwrxNameRelease(key);
+		return a;
+	}
+	// allocate both before touching the shard, so running out leaves it as it was
+	if ((e != NULL || d->count < d->capacity || wrxShareGrow(d) == WRX_OK) && (a = calloc(1, sizeof(wrxShareAtomic))) != NULL) {
+		if (e == NULL && (n = calloc(1, sizeof(wrxShareEntry))) == NULL) {
+			free(a);
+			a = NULL;
+		}
+	}
+	if (a != NULL) {
+		a->form = form;
+		a->live = 1;
+		a->changed = 1;
+		a->share = s;
+		strcpy(a->key, key);
+		if (e != NULL) {
+			memcpy(&old, &(*e)->v, sizeof(wrxInfo));
+			if (form == WRX_FORM_INTEGER && old.form == WRX_FORM_INTEGER) a->value = old.l[0];
+				else if (form == WRX_FORM_DOUBLE && old.form == WRX_FORM_DOUBLE) a->value = wrxAtomicBits(old.d[0]);
+				else if (form == WRX_FORM_DOUBLE && old.form == WRX_FORM_INTEGER) a->value = wrxAtomicBits((double)old.l[0]);
+			(*e)->v.form = WRX_FORM_ATOMIC;
+			(*e)->v.p = a;
+		} else {
+			strcpy(n->v.name, key);
+			n->v.form = WRX_FORM_ATOMIC;
+			n->v.p = a;
+			n->hash = hash;
+			n->key = key;
+			dwrxNameRetain(key);
+			n->next = d->bucket[hash & (d->capacity - 1)];
+			d->bucket[hash & (d->capacity - 1)] = n;
+			d->count++;
+			if (form == WRX_FORM_DOUBLE) a->value = wrxAtomicBits(0.0);
+		}
+		xatomic_store_relaxed(&s->dirty, 1);
+		pthread_mutex_lock(&s->lock);
+		a->next = s->atomics;
+		s->atomics = a;
+		pthread_mutex_unlock(&s->lock);
+	}
+	pthread_mutex_unlock(&d->lock);
+	dwrxClearInfo(&old);
+	dwrxNameRelease(key);
+	return a;
+}
+
+// *****************************************************************************
+// subscribers, each gets the changes to a share as one batch per frame
+
+// call func(p, s, changes, count, arg) on the main thread once a frame when s
+// has changed, changes holding the last value per key with WRX_FORM_NULL for a
+// removed key. main thread only
+void *wrxShareSubscribe(wrxState *p, wrxShare *s, wrxShareFunc func, void *arg) {
+	wrxShareSub *sub = calloc(1, sizeof(wrxShareSub)), **tail;
+
+	if (sub == NULL) {
+		wrxError(p, "wrxShareSubscribe() out of memory");
+		return NULL;
+	}
+	sub->share = s;
+	sub->func = func;
+	sub->arg = arg;
+	// in order, so subscribers hear about changes in the order they asked
+	for (tail = (wrxShareSub**)&s->subscriber; *tail != NULL; tail = &(*tail)->next);
+	*tail = sub;
+	xatomic_add(&s->subscribers, 1);
+	return sub;
+}
+
+// stop a subscription, a subscriber may unsubscribe while it is being called
+void wrxShareUnsubscribe(wrxState *p, void *subscription) {
+	wrxShareSub *sub = subscription;
+
+	if (sub == NULL || sub->func == NULL) return;
+	// unlinked after the next delivery, which may be running now
+	sub->func = NULL;
+	xatomic_sub(&sub->share->subscribers, 1);
+}
+
+// hand the frame's batch of changes to the subscribers, and drop the ones
+// that unsubscribed
+static void wrxShareDeliver(wrxState *p, wrxShare *s) {
+	wrxShareSub **sub, *gone;
+	wrxInfoTable batch;
+	wrxShareAtomic *a;
+	wrxInfo v, replaced;
+
+	// atomics don't push as they change, so add the ones that did. the list
+	// only grows at the front and nothing leaves it until the share goes
+	pthread_mutex_lock(&s->lock);
+	a = s->atomics;
+	pthread_mutex_unlock(&s->lock);
+	for (; a != NULL; a = a->next) {
+		if (!xatomic_load(&a->changed)) continue;
+		// clear it before reading, so a change after the read shows up next frame
+		xatomic_store(&a->changed, 0);
+		if (!xatomic_load(&a->live)) continue;
+		wrxAtomicLoad(a, &v);
+		strcpy(v.name, a->key);
+		replaced.form = WRX_FORM_NULL;
+		wrxSharePush(s, dwrxStringHash(a->key), &v, &replaced);
+		dwrxClearInfo(&replaced);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	memcpy(&batch, &s->push, sizeof(wrxInfoTable));
+	s->push.entry = NULL;
+	s->push.length = 0;
+	s->push.nindex = NULL;
+	pthread_mutex_unlock(&s->lock);
+
+	for (sub = (wrxShareSub**)&s->subscriber; *sub != NULL; sub = &(*sub)->next) {
+		if (batch.length > 0 && (*sub)->func != NULL) (*sub)->func(p, s, batch.entry, batch.length, (*sub)->arg);
+	}
+	for (sub = (wrxShareSub**)&s->subscriber; *sub != NULL; ) {
+		if ((*sub)->func == NULL) {
+			gone = *sub;
+			*sub = gone->next;
+			free(gone);
+		} else sub = &(*sub)->next;
+	}
+	wrxFreePush(&batch);
+}
+
+// *****************************************************************************
+// snapshots, readers pin the epoch in their thread's slot before picking up a
+// version and a replaced version is only freed once every pinned epoch is past
+// the one it was replaced in
+
+// copy the whole share with every shard locked, so the copy is one moment of it
+static wrxShareVersion *wrxShareFreeze(wrxShare *s, int publish) {
+	wrxShareVersion *v = NULL;
+	wrxShareEntry *e, *c;
+	int i, b, count = 0, capacity = 16, ok = 1;
+
+	for (i = 0; i < WRX_SHARE_SHARDS; i++) pthread_mutex_lock(&s->shard[i].lock);
+	for (i = 0; i < WRX_SHARE_SHARDS; i++) count += s->shard[i].count;
+	// a version only the publisher builds says the share is caught up. clear
+	// it before copying, atomics change without the shard locks and one that
+	// lands during the copy has to leave the share dirty for the next frame
+	if (publish) xatomic_swap(&s->dirty, 0);
+	// at most half full, so probes stay short
+	while (capacity < count * 2) capacity *= 2;
+	v = calloc(1, sizeof(wrxShareVersion) + capacity * sizeof(wrxShareEntry));
+	if (v != NULL) {
+		v->capacity = capacity;
+		for (i = 0; i < WRX_SHARE_SHARDS; i++) {
+			for (b = 0; b < s->shard[i].capacity; b++) {
+				for (e = s->shard[i].bucket[b]; e != NULL; e = e->next) {
+					c = &v->entry[e->hash & (capacity - 1)];
+					while (c->v.form != WRX_FORM_NULL) c = &v->entry[(c - v->entry + 1) & (capacity - 1)];
+					c->hash = e->hash;
+					c->key = e->key;
+					dwrxNameRetain(c->key);
+					if (wrxShareCopy(&c->v, &e->v) != WRX_OK) ok = 0;
+				}
+			}
+		}
+	} else ok = 0;
+	if (!ok && publish) xatomic_store(&s->dirty, 1);
+	for (i = WRX_SHARE_SHARDS - 1; i >= 0; i--) pthread_mutex_unlock(&s->shard[i].lock);
+	if (!ok) {
+		wrxFreeVersion(v);
+		v = NULL;
+	}
+	return v;
+}
+
+// a read only view of s as of the last frame boundary, good until the thread
+// calls wrxSnapshotRelease(). t is NULL on the main thread
+const void *wrxShareSnapshot(wrxState *p, wrxThread *t, wrxShare *s) {
+	wrxShareVersion *v;
+	void *e = NULL;
+
+	wrxEpochPin(p, t);
+	v = xatomic_load(&s->version);
+	if (v == NULL) {
+		// nobody has asked for this share before, so there is nothing published yet
+		v = wrxShareFreeze(s, 0);
+		if (v == NULL) return NULL;
+		if (!xatomic_cas(&s->version, &e, v)) {
+			wrxFreeVersion(v);
+			v = e;
+		}
+	}
+	return v;
+}
+
+// pin the thread's epoch if it isn't already, anything retired from here on
+// stays until wrxSnapshotRelease()
+void wrxEpochPin(wrxState *p, wrxThread *t) {
+	wrxEpochSlot *slot = &p->epochSlot[WRX_EPOCH_SLOT(t)];
+
+	if (xatomic_load_relaxed(&slot->epoch) == 0) {
+		xatomic_store(&slot->epoch, xatomic_load(&p->epoch));
+		// the pin has to be visible before we read anything that could be retired
+		xatomic_fence();
+	}
+}
+
+// the value under key in a snapshot, or NULL
+const wrxInfo *wrxSnapshotGet(const void *snapshot, const char *key) {
+	const wrxShareVersion *v = snapshot;
+	const wrxShareEntry *e;
+	unsigned int hash;
+
+	if ((key = dwrxInterned(key)) == NULL) return NULL;
+	hash = dwrxNameHash(key);
+	for (int i = hash & (v->capacity - 1); ; i = (i + 1) & (v->capacity - 1)) {
+		e = &v->entry[i];
+		if (e->v.form == WRX_FORM_NULL) return NULL;
+		if (e->key == key) return &e->v;
+	}
+}
+
+// done with every snapshot this thread took
+void wrxSnapshotRelease(wrxState *p, wrxThread *t) {
+	wrxEpochSlot *slot = &p->epochSlot[WRX_EPOCH_SLOT(t)];
+
+	if (xatomic_load_relaxed(&slot->epoch) == 0) return;
+	xatomic_store(&slot->epoch, 0);
+	slot->generation++;
+}
+
+// the oldest epoch any thread could still be reading in
+static unsigned long long wrxOldestEpoch(wrxState *p) {
+	unsigned long long oldest, e;
+
+	// the swaps before this have to land before we look at the pins
+	xatomic_fence();
+	oldest = xatomic_load(&p->epoch);
+	for (int i = 0; i <= WRX_MAX_THREADS; i++) {
+		e = xatomic_load(&p->epochSlot[i].epoch);
+		if (e != 0 && e < oldest) oldest = e;
+	}
+	return oldest;
+}
+
+// free the retired versions no pinned thread can still be reading
+static void wrxReclaimVersions(wrxState *p, unsigned long long oldest) {
+	wrxShareVersion **v, *gone;
+
+	for (v = (wrxShareVersion**)&p->retired; *v != NULL; ) {
+		if ((*v)->retired < oldest) {
+			gone = *v;
+			*v = gone->next;
+			wrxFreeVersion(gone);
+		} else v = &(*v)->next;
+	}
+}
+
+// on the main thread at the start of each frame, publish a new version of every
+// share that has snapshots and changed, then relay the changes to subscribers.
+// the main thread's own snapshots end here, and whatever the shares, gTable
+// and the name pool let go of before every pin is freed
+void wrxPublishShares(wrxState *p) {
+	wrxShareVersion *v, *old;
+	wrxShare *s, *first;
+	unsigned long long oldest;
+
+	wrxSnapshotRelease(p, NULL);
+	pthread_mutex_lock(&p->tableLock);
+	for (s = p->shares; s != NULL; s = s->next) {
+		if (xatomic_load(&s->version) == NULL || !xatomic_load_relaxed(&s->dirty)) continue;
+		if ((v = wrxShareFreeze(s, 1)) == NULL) continue;
+		old = xatomic_swap(&s->version, v);
+		old->retired = p->epoch;
+		old->next = p->retired;
+		p->retired = old;
+	}
+	first = p->shares;
+	pthread_mutex_unlock(&p->tableLock);
+	xatomic_add(&p->epoch, 1);
+	oldest = wrxOldestEpoch(p);
+	if (p->retired != NULL) wrxReclaimVersions(p, oldest);
+	if (p->gTable != NULL) dwrxReclaimSharedTable(p->gTable, oldest);
+	dwrxReclaimNames(p, oldest);
+
+	// subscribers may make new shares, those go on the front of the list and
+	// have nothing to deliver yet
+	for (s = first; s != NULL; s = s->next) {
+		if (s->subscriber != NULL) wrxShareDeliver(p, s);
+	}
+}
+
+void wrxFreeShares(wrxState *p) {
+	wrxShareVersion *v;
+	wrxShare *s;
+
+	pthread_mutex_lock(&p->tableLock);
+	while ((s = p->shares) != NULL) {
+		p->shares = s->next;
+		wrxFreeShare(s);
+	}
+	while ((v = p->retired) != NULL) {
+		p->retired = v->next;
+		wrxFreeVersion(v);
+	}
+	pthread_mutex_unlock(&p->tableLock);
+}
@@ -0,0 +1,190 @@
+/*
+	wrx-engine: timers
+
+	Jason A. Petrasko, muragami, muragami@wishray.com 2023
+
+	MIT License
+*/
+
+#include "wrx.h"
+#include <stdlib.h>
+#include <string.h>
+
+// a hierarchical timer wheel ticking in milliseconds: level 0 holds the next
+// 64ms one slot per tick, each level up covers 64 times the span of the one
+// below and its slots get spread back down as the clock reaches them
+#define WRX_WHEEL_BITS		6
+#define WRX_WHEEL_SIZE		(1 << WRX_WHEEL_BITS)
+#define WRX_WHEEL_MASK		(WRX_WHEEL_SIZE - 1)
+#define WRX_WHEEL_LEVELS	4
+#define WRX_WHEEL_SPAN		(1ULL << (WRX_WHEEL_BITS * WRX_WHEEL_LEVELS))
+
+#define WRX_TIMER_PENDING	0
+#define WRX_TIMER_FIRING	1
+#define WRX_TIMER_CANCELLED	2
+
+typedef struct wrxTimer {
+	struct wrxTimer *next;
+	struct wrxTimer *prev;
+	struct wrxTimer **head;				// the slot it is linked into
+	unsigned long long expires;			// tick it fires on
+	unsigned int period;				// 0 for a one shot
+	int state;
+	wrxTimerFunc func;
+	void *arg;
+} wrxTimer;
+
+typedef struct {
+	unsigned long long now;				// last tick run
+	unsigned long long target;			// tick this update runs up to
+	int count;							// timers on the wheel
+	wrxTimer *slot[WRX_WHEEL_LEVELS][WRX_WHEEL_SIZE];
+} wrxWheel;
+
+static unsigned long long wrxTimerTicks(wrxState *p) {
+	return (unsigned long long)(p->clock * 1000.0);
+}
+
+static wrxWheel *wrxGetWheel(wrxState *p) {
+	if (p->timers == NULL) {
+		wrxWheel *w = calloc(1, sizeof(wrxWheel));
+		if (w == NULL) return NULL;
+		w->now = w->target = wrxTimerTicks(p);
+		p->timers = w;
+	}
+	return p->timers;
+}
+
+// link t into the slot its expiry falls in, relative to now
+static void wrxWheelInsert(wrxWheel *w, wrxTimer *t) {
+	unsigned long long e = t->expires, delta;
+	wrxTimer **head;
+	int level;
+
+	if (e < w->now) e = t->expires = w->now;
+	delta = e - w->now;
+	// past the top of the wheel, park it at the far end and let the cascade re-place it
+	if (delta >= WRX_WHEEL_SPAN) e = w->now + WRX_WHEEL_SPAN - 1;
+	for (level = 0; level < WRX_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (WRX_WHEEL_BITS * (level + 1)))) break;
+	}
+	head = &w->slot[level][(e >> (WRX_WHEEL_BITS * level)) & WRX_WHEEL_MASK];
+	t->head = head;
+	t->prev = NULL;
+	t->next = *head;
+	if (*head != NULL) (*head)->prev = t;
+	*head = t;
+}
+
+static void wrxWheelUnlink(wrxTimer *t) {
+	if (t->prev != NULL) t->prev->next = t->next;
+		else *t->head = t->next;
+	if (t->next != NULL) t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+	t->head = NULL;
+}
+
+// spread a slot of a higher level back out over the levels below
+static void wrxWheelCascade(wrxWheel *w, int level, int index) {
+	wrxTimer *t = w->slot[level][index], *n;
+
+	w->slot[level][index] = NULL;
+	while (t != NULL) {
+		n = t->next;
+		wrxWheelInsert(w, t);
+		t = n;
+	}
+}
+
+// call func(p, arg) after ms, and then every period ms if period isn't 0. the
+// handle is good for wrxCancelTimer() until a one shot has fired
+void *wrxAddTimer(wrxState *p, unsigned int ms, unsigned int period, wrxTimerFunc func, void *arg) {
+	wrxWheel *w = wrxGetWheel(p);
+	wrxTimer *t;
+
+	if (w == NULL || (t = calloc(1, sizeof(wrxTimer))) == NULL) {
+		wrxError(p, "wrxAddTimer() out of memory");
+		return NULL;
+	}
+	// count from the tick being run when called from a timer, else from now
+	t->expires = ((w->target > w->now) ? w->now : wrxTimerTicks(p)) + ms;
+	// never the slot being fired, so a timer adding itself again can't spin
+	if (t->expires <= w->now) t->expires = w->now + 1;
+	t->period = period;
+	t->func = func;
+	t->arg = arg;
+	wrxWheelInsert(w, t);
+	w->count++;
+	return t;
+}
+
+// stop a timer, a timer may cancel itself while it fires
+void wrxCancelTimer(wrxState *p, void *timer) {
+	wrxWheel *w = p->timers;
+	wrxTimer *t = timer;
+
+	if (w == NULL || t == NULL) return;
+	if (t->state == WRX_TIMER_FIRING) {
+		t->state = WRX_TIMER_CANCELLED;
+		return;
+	}
+	wrxWheelUnlink(t);
+	w->count--;
+	free(t);
+}
+
+// run the wheel up to the clock, firing what falls due. an every timer fires
+// at most once per call, skipping the periods a slow frame jumped over
+void wrxRunTimers(wrxState *p) {
+	wrxWheel *w = p->timers;
+	wrxTimer *t, **head;
+	int level, index;
+
+	if (w == NULL) return;
+	w->target = wrxTimerTicks(p);
+	// nothing waiting, so there is nothing to tick through
+	if (w->count == 0) w->now = w->target;
+
+	while (w->now < w->target) {
+		w->now++;
+		index = w->now & WRX_WHEEL_MASK;
+		for (level = 1; index == 0 && level < WRX_WHEEL_LEVELS; level++) {
+			index = (w->now >> (WRX_WHEEL_BITS * level)) & WRX_WHEEL_MASK;
+			wrxWheelCascade(w, level, index);
+		}
+		// timers added by the callbacks always land in a later slot
+		head = &w->slot[0][w->now & WRX_WHEEL_MASK];
+		while ((t = *head) != NULL) {
+			wrxWheelUnlink(t);
+			t->state = WRX_TIMER_FIRING;
+			t->func(p, t->arg);
+			if (t->period != 0 && t->state != WRX_TIMER_CANCELLED) {
+				t->state = WRX_TIMER_PENDING;
+				t->expires += t->period;
+				if (t->expires <= w->target) t->expires += ((w->target - t->expires) / t->period + 1) * t->period;
+				wrxWheelInsert(w, t);
+			} else {
+				w->count--;
+				free(t);
+			}
+		}
+		if (w->count == 0) w->now = w->target;
+	}
+}
+
+void wrxFreeTimers(wrxState *p) {
+	wrxWheel *w = p->timers;
+	wrxTimer *t, *n;
+
+	if (w == NULL) return;
+	for (int level = 0; level < WRX_WHEEL_LEVELS; level++) {
+		for (int i = 0; i < WRX_WHEEL_SIZE; i++) {
+			for (t = w->slot[level][i]; t != NULL; t = n) {
+				n = t->next;
+				free(t);
+			}
+		}
+	}
+	free(w);
+	p->timers = NULL;
+}
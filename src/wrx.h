@@ -44,8 +44,31 @@ extern "C" {
 #define WRX_ID_BITS_20	20
 #define WRX_ID_BITS_24	24
 
-#define WRX_STD_THREADS	8
-#define WRX_MAX_THREADS	16
+// an id is a prefix in the top 8 bits, picking one of gTree[], over a slot
+// generation and then the slot's number in the low idBits
+#define WRX_ID(prefix, n)	(((unsigned int)(prefix) << 24) | (n))
+#define WRX_ID_PREFIX(id)	((id) >> 24)
+#define WRX_ID_NUMBER(id)	((id) & 0xFFFFFF)
+
+#define WRX_MAX_THREADS	64		// compute and io workers together
+#define WRX_MAIN_THREAD	-1		// thread id of the main lua state
+
+#define WRX_POOL_COMPUTE	0		// frame work, sized to the cores
+#define WRX_POOL_IO			1		// blocking reads and decoding
+#define WRX_POOLS			2
+
+#define WRX_MAX_STAGES	32
+#define WRX_STAGE_MAIN	(1 << 0)	// must run on the main thread
+#define WRX_STAGE_FINAL	(1 << 1)	// runs after every other stage
+
+#define WRX_SHARE_BITS		4
+#define WRX_SHARE_SHARDS	(1 << WRX_SHARE_BITS)	// locks per share
+
+#define WRX_INBOX_SIZE	8192	// messages per thread inbox, must be a power of 2
+
+#define WRX_FUTURE_PENDING	0
+#define WRX_FUTURE_DONE		1
+#define WRX_FUTURE_FAILED	2
 
 #define WRX_READ_FLAG	0xF0000000
 
@@ -66,6 +89,20 @@ extern "C" {
 #define WRX_FORM_POINTER	0x06
 #define WRX_FORM_TABLE		0x07
 #define WRX_FORM_LUAOBJ		0x08
+#define WRX_FORM_BOOLEAN	0x09
+#define WRX_FORM_BLOB		0x0A	// p is a wrxBlob, copies share it
+#define WRX_FORM_ATOMIC		0x0B	// p is a wrxShareAtomic, only ever inside a share
+#define WRX_FORM_CHANNEL	0x0C	// p is a wrxChannel, copies share it
+
+#define WRX_ATOMIC_SET		0
+#define WRX_ATOMIC_ADD		1
+#define WRX_ATOMIC_MAX		2
+#define WRX_ATOMIC_MIN		3
+
+#define WRX_MEMIO_READONLY	(1 << 0)
+#define WRX_MEMIO_WRITER	(1 << 1)	// the writing end of a channel
+#define WRX_MEMIO_READER	(1 << 2)	// the reading end of a channel
+#define WRX_MEMIO_STREAM	(WRX_MEMIO_WRITER | WRX_MEMIO_READER)
 
 // types of data the system might store in a table
 #define WRX_DATA_BINARY		0x0		// unknown binary data
@@ -73,6 +110,7 @@ extern "C" {
 #define WRX_DATA_LUA5		0x2		// Lua 5.4 code UTF8 text
 #define WRX_DATA_TABLE		0x3		// a wrx table (containing data)
 #define WRX_DATA_STATE		0x4		// a wrx table (containing data)
+#define WRX_DATA_PACKED		0x5		// a lua table packed by lwrxPackTable()
 // some flags for data objects
 #define WRX_DATA_NODE		0x10	// this data is a node, and has data following it
 #define WRX_DATA_ARRAY		0x20	// this data is a node, and has data following it
@@ -98,9 +136,31 @@ typedef struct {
     unsigned int pos;
     unsigned int imode;
     unsigned int local;
-    unsigned int unused[2];
+    unsigned int flags;
+    unsigned int unused;
 } wrxMemIO;
 
+// immutable bytes with a reference count, so every lua state can read them
+// without a copy. fill mem in before handing the blob to anyone else
+typedef struct {
+	int refs;
+	unsigned int length;
+	unsigned long long pad;		// keep mem 16 byte aligned
+	char mem[];
+} wrxBlob;
+
+// a lock free ring of bytes from one writer to one reader, see channel.c
+typedef struct {
+	int refs;
+	unsigned int capacity;		// a power of 2
+	char pad0[56];
+	unsigned long long head;	// bytes ever written, only the writer moves it
+	char pad1[56];
+	unsigned long long tail;	// bytes ever read, only the reader moves it
+	char pad2[56];
+	char mem[];
+} wrxChannel;
+
 typedef struct {
 	unsigned short id;
 	unsigned short flags;
@@ -122,6 +182,7 @@ typedef struct {
 		char str[124];
 		double d[16];
 		int i[32];
+		long long l[16];
 		void *p;
 	};
 } wrxInfo;
@@ -133,25 +194,102 @@ typedef struct {
 	void *nindex;
 } wrxInfoTable;
 
+// one lock's worth of a share, keys hash to a shard by their top bits
 typedef struct {
 	pthread_mutex_t lock;
+	int count;
+	int capacity;			// buckets, a power of 2
+	void **bucket;
+	char pad[64];			// keep the shard locks off each other's cache lines
+} wrxShareShard;
+
+// a number in a share that threads update without locks, it stays where it is
+// for the life of the share so handles to it never go stale
+typedef struct wrxShareAtomic {
+	long long value;		// the integer, or the double's bits
+	int form;				// WRX_FORM_INTEGER or WRX_FORM_DOUBLE
+	int changed;			// updated since the last relay
+	int live;				// still what the share holds under key
+	char key[124];
+	struct wrxShare *share;
+	struct wrxShareAtomic *next;
+} wrxShareAtomic;
+
+typedef struct wrxShare {
+	pthread_mutex_t lock;	// guards push
 	wrxInfo shareName;
-	wrxInfoTable info;
-	wrxInfoTable push;		// changed values to relay
+	wrxShareShard shard[WRX_SHARE_SHARDS];
+	int dirty;				// written since the last snapshot was published
+	void *version;			// the published snapshot, NULL until someone asks for one
+	wrxInfoTable push;		// changed values to relay, the last one per key
+	int subscribers;		// nothing is pushed while this is 0
+	void *subscriber;
+	wrxShareAtomic *atomics;	// guarded by lock
+	struct wrxShare *next;
 } wrxShare;
 
+// a small value sent between threads, strings that don't fit in str are
+// allocated and p holds them
+typedef struct {
+	unsigned int seq;
+	short from;
+	short form;
+	unsigned int length;
+	unsigned int unused;
+	union {
+		long long l;
+		double d;
+		void *p;
+		char str[48];
+	};
+} wrxMessage;
+
+// the results of background work, filled in once by whoever does the work
+typedef struct {
+	int refs;
+	int status;
+	int count;
+	wrxInfo *results;
+	char error[WRX_LINE];
+} wrxFuture;
+
+// what a lua state's heap has handed out
+typedef struct {
+	size_t bytes;			// in use
+	size_t peak;
+	size_t pooled;			// held in chunks for the small size classes
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long objects[LUA_NUMTYPES];	// objects created, by lua type
+} wrxHeapStats;
+
+// what a thread is reading, see wrxShareSnapshot()
+typedef struct {
+	unsigned long long epoch;	// pinned epoch, 0 when not pinned
+	unsigned int generation;	// bumped on every release, so stale views can tell
+	char pad[64 - sizeof(unsigned long long) - sizeof(unsigned int)];
+} wrxEpochSlot;
+
+#define WRX_EPOCH_SLOT(t)	((t) != NULL ? (t)->id + 1 : 0)	// slot 0 is the main thread
+
 typedef struct {
 	pthread_t handle;
 	pthread_mutex_t stateLock;
-	pthread_mutex_t msgLock;
+	void *inbox;			// wrxMessage ring, many senders and this thread receiving
 	unsigned int mode;
 	int id;
+	int pool;				// WRX_POOL_COMPUTE or WRX_POOL_IO
 	int sleepUMS;
 	void *state;
+	void *queue;			// this thread's job deque
+	lua_State *L;
 } wrxThread;
 
+// one slot of an id tree, the bottom level is 16 of these
 typedef struct {
-	wrxInfo* data;
+	wrxInfo* data;			// NULL while the slot is free
+	unsigned int generation;	// bumped each time the slot is freed
+	unsigned int next;		// the next free slot while this one is free
 } wrxIdTreeNode;
 
 typedef struct {
@@ -161,6 +299,9 @@ typedef struct {
 typedef struct {
 	wrxIdTreeLevel* root;
 	unsigned int idBits;
+	unsigned int next;		// slots from here up have never been used
+	unsigned int freeHead;	// freed slots, oldest first, 0 when there are none
+	unsigned int freeTail;
 } wrxIdTree;
 
 typedef struct {
@@ -180,15 +321,24 @@ typedef struct {
 	TPixel* scrClearColor;
 	lua_State* L;
 	unsigned int idBits;
-	unsigned int nextId;
-	void* gTable;
+	void* gTable;			// a dwrxNewSharedTable(), readers never lock it
 	wrxIdTree* gTree[256];
 	void *audio;
-	int threads;
+	void *jobs;
+	void *inbox;
+	void *frame;
+	void *timers;
+	wrxShare *shares;		// every wrx.share(), guarded by tableLock
+	unsigned long long epoch;	// bumped each time snapshots are published
+	void *retired;			// replaced snapshots waiting for their readers to finish
+	int threads;			// compute workers, 0 sizes from the core count
+	int ioThreads;			// io workers, ids follow the compute workers
+	int pinThreads;
 	unsigned short workTable[4096];
 	pthread_mutex_t stateLock;
 	pthread_mutex_t tableLock;
 	wrxThread *thread[WRX_MAX_THREADS];
+	wrxEpochSlot epochSlot[WRX_MAX_THREADS + 1];
 } wrxState;
 
 
@@ -202,21 +352,131 @@ int wrxRunning(wrxState *p);
 const char* wrxGetError(wrxState *p);
 int wrxError(wrxState *p, const char *fmt, ...);
 wrxInfo* wrxNewIdInfo(wrxState *p, int prefix);
+wrxInfo *wrxGetIdInfo(wrxState *p, unsigned int id);
+void wrxFreeIdInfo(wrxState *p, wrxInfo *v);
+void wrxSetupLuaState(wrxState *p, lua_State *l);
+lua_State *wrxNewLuaState();
+void wrxCloseLuaState(lua_State *L);
+void wrxFreeLuaHeap(void *heap);
+void wrxGetHeapStats(lua_State *L, wrxHeapStats *stats);
+
+typedef void (*wrxStageFunc)(wrxState *p, wrxThread *t, void *arg);
+int wrxAddStage(wrxState *p, const char *name, wrxStageFunc func, void *arg, int flags);
+int wrxStageAfter(wrxState *p, const char *name, const char *after);
+int wrxStageFlags(wrxState *p, const char *name);
+int wrxRunFrame(wrxState *p);
+void wrxFreeFrame(wrxState *p);
+
+typedef void (*wrxTimerFunc)(wrxState *p, void *arg);
+void *wrxAddTimer(wrxState *p, unsigned int ms, unsigned int period, wrxTimerFunc func, void *arg);
+void wrxCancelTimer(wrxState *p, void *timer);
+void wrxRunTimers(wrxState *p);
+void wrxFreeTimers(wrxState *p);
+
+wrxShare *wrxGetShare(wrxState *p, const char *name);
+int wrxShareGet(wrxShare *s, const char *key, wrxInfo *v);
+int wrxShareSet(wrxShare *s, const char *key, wrxInfo *v);
+void wrxFreeShares(wrxState *p);
+wrxShareAtomic *wrxShareGetAtomic(wrxShare *s, const char *key, int form);
+void wrxAtomicLoad(wrxShareAtomic *a, wrxInfo *v);
+int wrxAtomicUpdate(wrxShareAtomic *a, int op, wrxInfo *v);
+int wrxAtomicCas(wrxShareAtomic *a, wrxInfo *expect, wrxInfo *v);
+typedef void (*wrxShareFunc)(wrxState *p, wrxShare *s, wrxInfo *changes, int count, void *arg);
+void *wrxShareSubscribe(wrxState *p, wrxShare *s, wrxShareFunc func, void *arg);
+void wrxShareUnsubscribe(wrxState *p, void *subscription);
+const void *wrxShareSnapshot(wrxState *p, wrxThread *t, wrxShare *s);
+const wrxInfo *wrxSnapshotGet(const void *snapshot, const char *key);
+void wrxSnapshotRelease(wrxState *p, wrxThread *t);
+void wrxEpochPin(wrxState *p, wrxThread *t);
+void wrxPublishShares(wrxState *p);
+
+wrxChannel *wrxNewChannel(unsigned int bytes);
+void wrxRetainChannel(wrxChannel *c);
+void wrxReleaseChannel(wrxChannel *c);
+unsigned int wrxChannelUsed(wrxChannel *c);
+unsigned int wrxChannelRoom(wrxChannel *c);
+int wrxChannelWrite(wrxChannel *c, const void *mem, unsigned int length);
+int wrxChannelRead(wrxChannel *c, void *mem, unsigned int length);
+
+typedef void (*wrxJobFunc)(wrxThread *t, void *arg);
+typedef void (*wrxRangeFunc)(wrxThread *t, char *mem, unsigned int offset, unsigned int length, void *arg);
+typedef void (*wrxKernelFunc)(char *mem, unsigned int offset, unsigned int length, wrxInfo *args, int nargs);
+int wrxJobStart(wrxState *p);
+void wrxJobStop(wrxState *p);
+int wrxJobSubmit(wrxState *p, wrxJobFunc func, void *arg);
+int wrxJobSubmitTo(wrxState *p, int pool, wrxJobFunc func, void *arg);
+void wrxJobWork(wrxThread *t);
+void wrxJobDone(wrxState *p, int *flag, int value);
+void wrxJobWait(wrxState *p, int *flag);
+int wrxParallelFor(wrxState *p, char *mem, unsigned int length, unsigned int grain, wrxRangeFunc func, void *arg);
+int wrxAddKernel(const char *name, wrxKernelFunc func);
+wrxKernelFunc wrxGetKernel(const char *name);
+void *wrxNewInbox();
+void wrxFreeInbox(void *inbox);
+void *wrxGetInbox(wrxState *p, int thread);
+int wrxInboxPut(void *inbox, wrxMessage *m);
+int wrxInboxGet(void *inbox, wrxMessage *m);
+int wrxInboxDrain(void *inbox, void (*func)(wrxMessage *m, void *arg), void *arg);
+void wrxClearMessage(wrxMessage *m);
+wrxFuture *wrxNewFuture();
+void wrxFutureRetain(wrxFuture *f);
+void wrxFutureRelease(wrxFuture *f);
+void wrxFutureResolve(wrxState *p, wrxFuture *f, wrxInfo *results, int count);
+void wrxFutureFail(wrxState *p, wrxFuture *f, const char *fmt, ...);
+void wrxFutureWait(wrxState *p, wrxFuture *f);
 
 void lwrxRegister(lua_State *L);
 int lwrxLoadString(wrxState *p, wrxData *src, const char *name);
+int lwrxLoadChunk(lua_State *L, wrxData *src, const char *name);
 void lwrxFieldToInteger(wrxState *p, int index, const char *name, int *v);
+void lwrxFieldToBoolean(wrxState *p, int index, const char *name, int *v);
 void lwrxFieldToFloat(wrxState *p, int index, const char *name, float *v);
 void lwrxFieldToDouble(wrxState *p, int index, const char *name, double *v);
 void lwrxFieldToString(wrxState *p, int index, const char *name, char *buffer, int bsize);
+wrxThread *lwrxGetThread(lua_State *L);
+int lwrxToInfo(lua_State *L, int index, wrxInfo *v);
+void lwrxPushInfo(lua_State *L, wrxInfo *v);
+int lwrxPackTable(lua_State *L, int index, wrxData *d);
+int lwrxUnpackTable(lua_State *L, wrxData *d);
+void lwrxDispatchMessages(wrxState *p);
+void lwrxResumeAwaiting(wrxState *p);
 
 void dwrxStart();
 void dwrxStop();
 void *dwrxNewTable(wrxState *p);
+void dwrxFreeTable(void *table);
+wrxInfo *dwrxTableGet(void *table, const char *name);
+void dwrxTablePut(void *table, const char *name, const wrxInfo *v);
+void dwrxTableDelete(void *table, const char *name);
+typedef int (*dwrxTableFunc)(const char *name, wrxInfo *v, void *arg);
+int dwrxTablePrefix(void *table, const char *prefix, dwrxTableFunc func, void *arg);
+int dwrxTableRange(void *table, const char *from, const char *to, dwrxTableFunc func, void *arg);
+void *dwrxNewSharedTable(wrxState *p);
+void dwrxFreeSharedTable(void *table);
+void dwrxReclaimSharedTable(void *table, unsigned long long oldest);
+const wrxInfo *dwrxSharedGet(void *table, wrxThread *t, const char *name);
+int dwrxSharedPut(void *table, const char *name, const wrxInfo *v);
+void dwrxSharedDelete(void *table, const char *name);
+int dwrxSharedPrefix(void *table, const char *prefix, dwrxTableFunc func, void *arg);
+int dwrxSharedRange(void *table, const char *from, const char *to, dwrxTableFunc func, void *arg);
+const char *dwrxIntern(const char *s);
+const char *dwrxInterned(const char *s);
+unsigned int dwrxNameHash(const char *name);
+void dwrxNameRetain(const char *name);
+void dwrxNameRelease(const char *name);
+unsigned int dwrxStringHash(const char *s);
+void dwrxReclaimNames(wrxState *p, unsigned long long oldest);
 void *dwrxNewTree(wrxState *p, int id_bits);
 void dwrxFreeTree(wrxIdTree *tree);
+wrxInfo *dwrxTreeGet(wrxIdTree *tree, unsigned int id);
+unsigned int dwrxTreeAdd(wrxIdTree *tree, wrxInfo *v);
+wrxInfo *dwrxTreeRemove(wrxIdTree *tree, unsigned int id);
 wrxInfo *dwrxReadFile(const char* fname);
 void dwrxFreeInfo(wrxInfo *p);
+void dwrxClearInfo(wrxInfo *p);
+wrxBlob *dwrxNewBlob(const void *mem, unsigned int length);
+void dwrxRetainBlob(wrxBlob *b);
+void dwrxReleaseBlob(wrxBlob *b);
 
 // ********************************************************
 #endif
@@ -4,7 +4,12 @@
     MIT License: https://opensource.org/licenses/MIT
 */
 
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
 #include "xthread.h"
+#include <time.h>
 
 #ifdef _WIN32
 
@@ -115,6 +120,14 @@ int xthread_join(pthread_t thread, xthread_ret *retval) {
     return 0;
 }
 
+// keep thread on one logical cpu, 0 on success
+int xthread_pin(pthread_t thread, unsigned int cpu) {
+    // beyond 64 cpus windows wants processor groups, leave those threads be
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return 1;
+    return SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpu) == 0;
+}
+
 #else
 
 #ifdef __APPLE__
@@ -125,6 +138,13 @@ unsigned int pcthread_get_num_procs() {
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+// macos has no hard affinity, only hints through thread_policy_set()
+int xthread_pin(pthread_t thread, unsigned int cpu) {
+    (void)thread;
+    (void)cpu;
+    return 1;
+}
+
 #else
 
 #include <stdio.h>
@@ -134,6 +154,15 @@ unsigned int pcthread_get_num_procs() {
     return get_nprocs();
 }
 
+// keep thread on one logical cpu, 0 on success
+int xthread_pin(pthread_t thread, unsigned int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+}
+
 #endif
 
 int xthread_create(pthread_t* thread, xthread_ret (*start_routine)(void *), void *arg) {
@@ -147,9 +176,20 @@ int xthread_join(pthread_t thread, xthread_ret *retval) {
 
 #endif
 
+// an absolute time ms from now, for pthread_cond_timedwait()
 void ms_to_timespec(struct timespec *ts, unsigned int ms) {
     if (ts == NULL)
         return;
+#ifdef _WIN32
     ts->tv_sec = (ms / 1000) + time(NULL);
     ts->tv_nsec = (ms % 1000) * 1000000;
+#else
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+#endif
 }
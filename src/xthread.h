@@ -59,9 +59,23 @@ int xthread_join(pthread_t thread, xthread_ret *retval);
 
 #endif
 
+// *****************************************************************************************************
+// atomics and thread locals, clang and gcc both provide these on every platform we target
+#define xthread_local               __thread
+#define xatomic_load(p)             __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define xatomic_load_relaxed(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define xatomic_store(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define xatomic_store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define xatomic_add(p, v)           __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define xatomic_sub(p, v)           __atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define xatomic_swap(p, v)          __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define xatomic_cas(p, e, v)        __atomic_compare_exchange_n((p), (e), (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+#define xatomic_fence()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
 // *****************************************************************************************************
 // utilities
 unsigned int pcthread_get_num_procs();
+int xthread_pin(pthread_t thread, unsigned int cpu);
 void ms_to_timespec(struct timespec *ts, unsigned int ms);
 
 #endif
\ No newline at end of file